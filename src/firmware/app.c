@@ -17,7 +17,23 @@
 #include "eventlog.h"
 #include "util.h"
 #include "system.h"
+#include "thermal.h"
+#include "battery.h"
 
+#include <string.h>
+
+
+// Optional assist pipeline stages, stages not in this list always run.
+#define STAGE_PRETENSION		0x0001
+#define STAGE_PAS_CADENCE		0x0002
+#define STAGE_PAS_TORQUE		0x0004
+#define STAGE_CRUISE			0x0008
+#define STAGE_THROTTLE			0x0010
+#define STAGE_SPEED_LIMIT		0x0020
+#define STAGE_LVC_FLOOR			0x0040
+#define STAGE_SHIFT_SENSOR		0x0080
+#define STAGE_POWER_LIMIT		0x0100
+#define STAGE_BOOST				0x0200
 
 typedef struct
 {
@@ -33,6 +49,13 @@ typedef struct
 	uint8_t keep_current_target_percent;
 	uint16_t keep_current_ramp_start_rpm_x10;
 	uint16_t keep_current_ramp_end_rpm_x10;
+	int32_t keep_current_ramp_inv_x65536;	// 1 / ramp rpm range
+
+	// power
+	uint16_t max_power_w;
+
+	// STAGE_* which can affect target current with current level and config
+	uint16_t stages;
 
 } assist_level_data_t;
 
@@ -44,9 +67,17 @@ static int32_t global_throttle_speed_limit_rpm_x10;
 static uint16_t lvc_voltage_x100;
 static uint16_t lvc_ramp_down_start_voltage_x100;
 static uint16_t lvc_ramp_down_end_voltage_x100;
+static uint16_t lvc_floor_voltage_x100;
+static int32_t lvc_ramp_down_slope_x65536;
 
 static assist_level_data_t assist_level_data;
 static uint16_t speed_limit_ramp_interval_rpm_x10;
+static int32_t speed_limit_ramp_inv_x65536;	// 1 / ramp rpm range
+
+static int32_t thermal_ramp_slope_x65536;
+#if HAS_TORQUE_SENSOR
+static int32_t torque_current_slope_x65536;	// amp x100 to percent of max current
+#endif
 
 static bool cruise_paused;
 static int8_t temperature_contr_c;
@@ -57,6 +88,26 @@ static uint32_t power_blocked_until_ms;
 
 static uint16_t pretension_cutoff_speed_rpm_x10;
 
+static uint8_t boost_continuous_percent;
+static uint16_t boost_continuous_current_x10;
+static int32_t boost_budget_max_x100;	// A^2s x100
+static int32_t boost_budget_x100;
+static uint8_t boost_budget_percent;
+
+static int32_t power_limit_integral_x256;	// percent x256
+
+static uint8_t limiting_flags;
+
+static sensors_snapshot_t sensors;
+
+static app_trace_t trace;
+static uint8_t trace_last_current;
+static app_trace_history_t trace_history[TRACE_HISTORY_SIZE];
+static uint8_t trace_history_next;
+static uint8_t trace_history_count;
+static uint8_t trace_history_reduced_flags;
+static uint32_t trace_history_next_ms;
+
 static bool lights_state = false;
 
 void apply_pas_cadence(uint8_t* target_current, uint8_t throttle_percent);
@@ -70,8 +121,11 @@ bool apply_throttle(uint8_t* target_current, uint8_t throttle_percent);
 bool apply_speed_limit(uint8_t* target_current, uint8_t throttle_percent, bool pas_engaged, bool throttle_override);
 bool apply_thermal_limit(uint8_t* target_current);
 bool apply_low_voltage_limit(uint8_t* target_current);
+bool apply_low_voltage_floor_limit(uint8_t* target_current);
 bool apply_shift_sensor_interrupt(uint8_t* target_current);
+bool apply_power_limit(uint8_t* target_current);
 bool apply_brake(uint8_t* target_current);
+void apply_boost(uint8_t* target_current, bool enable);
 void apply_current_ramp_up(uint8_t* target_current, bool enable);
 void apply_current_ramp_down(uint8_t* target_current, bool enable);
 
@@ -79,6 +133,11 @@ bool check_power_block();
 void block_power_for(uint16_t ms);
 
 void reload_assist_params();
+uint16_t get_active_stages();
+
+void trace_begin(uint8_t requested_current);
+void trace_stage(uint8_t stage, uint8_t target_current);
+void trace_end(uint8_t target_current);
 
 uint16_t convert_wheel_speed_kph_to_rpm(uint8_t speed_kph);
 
@@ -99,19 +158,66 @@ void app_init()
 		(full_voltage_range_x100 * BATTERY_EMPTY_OFFSET_PERCENT / 100));
 	lvc_ramp_down_start_voltage_x100 = (uint16_t)(lvc_ramp_down_end_voltage_x100 +
 		((padded_voltage_range_x100 * LVC_RAMP_DOWN_OFFSET_PERCENT) / 100));
+	lvc_floor_voltage_x100 = lvc_voltage_x100 + g_config.lvc_floor_margin_x10v * 10u;
+
+	lvc_ramp_down_slope_x65536 = 0;
+	if (lvc_ramp_down_start_voltage_x100 > lvc_ramp_down_end_voltage_x100)
+	{
+		lvc_ramp_down_slope_x65536 = SLOPE_X65536(lvc_ramp_down_start_voltage_x100 - lvc_ramp_down_end_voltage_x100,
+			100 - LVC_LOW_CURRENT_PERCENT);
+	}
+
+	thermal_ramp_slope_x65536 = SLOPE_X65536(MAX_TEMPERATURE_RAMP_DOWN_INTERVAL * 100,
+		MAX_TEMPERATURE_LOW_CURRENT_PERCENT - 100);
+
+#if HAS_TORQUE_SENSOR
+	torque_current_slope_x65536 = 0;
+	if (g_config.max_current_amps > 0)
+	{
+		torque_current_slope_x65536 = SLOPE_X65536(g_config.max_current_amps * 100u, 100);
+	}
+#endif
 
 	global_speed_limit_rpm = 0;
 	global_throttle_speed_limit_rpm_x10 = 0;
 	temperature_contr_c = 0;
 	temperature_motor_c = 0;
 
-	ramp_up_current_interval_ms = (g_config.max_current_amps * 10u) / g_config.current_ramp_amps_s;
+	ramp_up_current_interval_ms = (app_get_max_current_amps() * 10u) / g_config.current_ramp_amps_s;
 	power_blocked_until_ms = 0;
 
 	speed_limit_ramp_interval_rpm_x10 = convert_wheel_speed_kph_to_rpm(SPEED_LIMIT_RAMP_DOWN_INTERVAL_KPH) * 10;
+	speed_limit_ramp_inv_x65536 = 0;
+	if (speed_limit_ramp_interval_rpm_x10 > 0)
+	{
+		speed_limit_ramp_inv_x65536 = SLOPE_X65536(2 * speed_limit_ramp_interval_rpm_x10, 1);
+	}
 
 	pretension_cutoff_speed_rpm_x10 = convert_wheel_speed_kph_to_rpm(g_config.pretension_speed_cutoff_kph) * 10;
 
+	boost_continuous_percent = (uint8_t)((g_config.max_current_amps * 100u) / app_get_max_current_amps());
+	boost_continuous_current_x10 = g_config.max_current_amps * 10u;
+	boost_budget_max_x100 = 0;
+	if (boost_continuous_percent < 100)
+	{
+		// (I_boost^2 - I_max^2) * t
+		uint16_t boost_current_x10 = g_config.boost_current_amps * 10u;
+		boost_budget_max_x100 = ((int32_t)boost_current_x10 * boost_current_x10 -
+			(int32_t)boost_continuous_current_x10 * boost_continuous_current_x10) * g_config.boost_duration_s;
+	}
+	boost_budget_x100 = boost_budget_max_x100;
+	boost_budget_percent = boost_budget_max_x100 > 0 ? 100 : 0;
+
+	power_limit_integral_x256 = 100 * 256l;
+	limiting_flags = 0;
+
+	memset(&trace, 0, sizeof(trace));
+	trace_last_current = 0;
+	trace_history_next = 0;
+	trace_history_count = 0;
+	trace_history_reduced_flags = 0;
+	trace_history_next_ms = 0;
+
 	cruise_paused = true;
 	operation_mode = OPERATION_MODE_DEFAULT;
 
@@ -131,6 +237,8 @@ void app_process()
 	uint8_t target_cadence = assist_level_data.level.max_cadence_percent;
 	uint8_t throttle_percent = throttle_map_response(throttle_read());
 
+	sensors_snapshot(&sensors);
+
 	bool pas_engaged = false;
 	bool throttle_override = false;
 
@@ -144,17 +252,33 @@ void app_process()
 	}
 	else
 	{
-		apply_pretension(&target_current);
-		apply_pas_cadence(&target_current, throttle_percent);
+		if (assist_level_data.stages & STAGE_PRETENSION)
+		{
+			apply_pretension(&target_current);
+		}
+
+		if (assist_level_data.stages & STAGE_PAS_CADENCE)
+		{
+			apply_pas_cadence(&target_current, throttle_percent);
+		}
 #if HAS_TORQUE_SENSOR
-		apply_pas_torque(&target_current);
+		if (assist_level_data.stages & STAGE_PAS_TORQUE)
+		{
+			apply_pas_torque(&target_current);
+		}
 #endif // HAS_TORQUE_SENSOR
 
 		pas_engaged = target_current > 0;
 
-		apply_cruise(&target_current, throttle_percent);
+		if (assist_level_data.stages & STAGE_CRUISE)
+		{
+			apply_cruise(&target_current, throttle_percent);
+		}
 
-		throttle_override = apply_throttle(&target_current, throttle_percent);
+		if (assist_level_data.stages & STAGE_THROTTLE)
+		{
+			throttle_override = apply_throttle(&target_current, throttle_percent);
+		}
 
 		// override target cadence if configured in assist level
 		if (throttle_override &&
@@ -165,20 +289,61 @@ void app_process()
 		}
 	}
 
-	bool speed_limiting = apply_speed_limit(&target_current, throttle_percent, pas_engaged, throttle_override);
+	trace_begin(target_current);
+
+	bool speed_limiting = (assist_level_data.stages & STAGE_SPEED_LIMIT) &&
+		apply_speed_limit(&target_current, throttle_percent, pas_engaged, throttle_override);
+	trace_stage(TRACE_STAGE_SPEED, target_current);
+
 	bool thermal_limiting = apply_thermal_limit(&target_current);
+	trace_stage(TRACE_STAGE_THERMAL, target_current);
+
 	bool lvc_limiting = apply_low_voltage_limit(&target_current);
+	if (assist_level_data.stages & STAGE_LVC_FLOOR)
+	{
+		lvc_limiting = apply_low_voltage_floor_limit(&target_current) || lvc_limiting;
+	}
+	trace_stage(TRACE_STAGE_LVC, target_current);
+
 	bool shift_limiting =
 #if HAS_SHIFT_SENSOR_SUPPORT
-		apply_shift_sensor_interrupt(&target_current);
+		(assist_level_data.stages & STAGE_SHIFT_SENSOR) && apply_shift_sensor_interrupt(&target_current);
 #else
 		false;
 #endif
-	bool is_limiting = speed_limiting || thermal_limiting || lvc_limiting || shift_limiting;
+	trace_stage(TRACE_STAGE_SHIFT, target_current);
+
+	bool power_limiting = (assist_level_data.stages & STAGE_POWER_LIMIT) &&
+		apply_power_limit(&target_current);
+	trace_stage(TRACE_STAGE_POWER, target_current);
+
+	bool is_limiting = speed_limiting || thermal_limiting || lvc_limiting || shift_limiting || power_limiting;
+
+	limiting_flags =
+		(speed_limiting ? LIMITING_FLAG_SPEED : 0) |
+		(thermal_limiting ? LIMITING_FLAG_THERMAL : 0) |
+		(lvc_limiting ? LIMITING_FLAG_LVC : 0) |
+		(shift_limiting ? LIMITING_FLAG_SHIFT : 0) |
+		(power_limiting ? LIMITING_FLAG_POWER : 0);
+
 	bool is_braking = apply_brake(&target_current);
+	trace_stage(TRACE_STAGE_BRAKE, target_current);
+
+	if (assist_level_data.stages & STAGE_BOOST)
+	{
+		apply_boost(&target_current, !is_limiting);
+	}
+	trace_stage(TRACE_STAGE_BOOST, target_current);
 
+#if HAS_MOTOR_CURRENT_RAMP
+	motor_set_fast_current_ramp(throttle_override && !is_limiting);
+#else
 	apply_current_ramp_up(&target_current, is_limiting || !throttle_override);
+#endif
 	apply_current_ramp_down(&target_current, !is_braking && !shift_limiting);
+	trace_stage(TRACE_STAGE_RAMP, target_current);
+
+	trace_end(target_current);
 
 	motor_set_target_speed(target_cadence);
 	motor_set_target_current(target_current);
@@ -203,6 +368,13 @@ void app_process()
 }
 
 
+bool app_event_pending()
+{
+	// always consume sensor event
+	bool pending = sensors_event_pending();
+	return throttle_step_detected() || pending;
+}
+
 void app_set_assist_level(uint8_t level)
 {
 	if (assist_level != level)
@@ -346,6 +518,43 @@ uint8_t app_get_status_code()
 	return STATUS_NORMAL;
 }
 
+uint8_t app_get_max_current_amps()
+{
+	if (g_config.boost_current_amps > g_config.max_current_amps && g_config.boost_duration_s > 0)
+	{
+		return g_config.boost_current_amps;
+	}
+
+	return g_config.max_current_amps;
+}
+
+uint8_t app_get_boost_budget_percent()
+{
+	return boost_budget_percent;
+}
+
+uint8_t app_get_limiting_flags()
+{
+	return limiting_flags;
+}
+
+const app_trace_t* app_get_trace()
+{
+	return &trace;
+}
+
+uint8_t app_get_trace_history_count()
+{
+	return trace_history_count;
+}
+
+const app_trace_history_t* app_get_trace_history(uint8_t index)
+{
+	// oldest entry is at next write position when buffer is full
+	uint8_t i = trace_history_next + TRACE_HISTORY_SIZE - trace_history_count + index;
+	return &trace_history[i % TRACE_HISTORY_SIZE];
+}
+
 uint8_t app_get_temperature()
 {
 	int8_t temp_max = MAX(temperature_contr_c, temperature_motor_c);
@@ -360,7 +569,7 @@ uint8_t app_get_temperature()
 
 void apply_pretension(uint8_t* target_current)
 {
-	uint16_t current_speed_rpm_x10 = speed_sensor_get_rpm_x10();
+	uint16_t current_speed_rpm_x10 = sensors.speed_rpm_x10;
 
 	if (g_config.use_speed_sensor && g_config.use_pretension && current_speed_rpm_x10 > pretension_cutoff_speed_rpm_x10)
 	{
@@ -373,7 +582,7 @@ void apply_pas_cadence(uint8_t* target_current, uint8_t throttle_percent)
 {
 	if ((assist_level_data.level.flags & ASSIST_FLAG_PAS) && !(assist_level_data.level.flags & ASSIST_FLAG_PAS_TORQUE))
 	{
-		if (pas_is_pedaling_forwards() && pas_get_pulse_counter() > g_config.pas_start_delay_pulses)
+		if (sensors.pas_pedaling_forwards && sensors.pas_pulse_counter > g_config.pas_start_delay_pulses)
 		{
 			if (assist_level_data.level.flags & ASSIST_FLAG_PAS_VARIABLE)
 			{
@@ -394,17 +603,17 @@ void apply_pas_cadence(uint8_t* target_current, uint8_t throttle_percent)
 				if (g_config.pas_keep_current_percent < 100)
 				{
 					if (*target_current > assist_level_data.keep_current_target_percent &&
-						pas_get_cadence_rpm_x10() > assist_level_data.keep_current_ramp_start_rpm_x10)
+						sensors.pas_cadence_rpm_x10 > assist_level_data.keep_current_ramp_start_rpm_x10)
 					{
-						uint32_t cadence = MIN(pas_get_cadence_rpm_x10(), assist_level_data.keep_current_ramp_end_rpm_x10);
+						uint32_t cadence = MIN(sensors.pas_cadence_rpm_x10, assist_level_data.keep_current_ramp_end_rpm_x10);
 
 						// ramp down current towards keep_current_target_percent with rpm above keep_current_ramp_start_rpm_x10
-						*target_current = MAP32(
+						*target_current = MAP_SLOPE32(
 							cadence,	// in
 							assist_level_data.keep_current_ramp_start_rpm_x10,		// in_min
-							assist_level_data.keep_current_ramp_end_rpm_x10,		// in_max
 							*target_current,										// out_min
-							assist_level_data.keep_current_target_percent);			// out_max
+							(assist_level_data.keep_current_target_percent - *target_current) *
+								assist_level_data.keep_current_ramp_inv_x65536);	// slope
 					}
 				}
 			}
@@ -417,10 +626,10 @@ void apply_pas_torque(uint8_t* target_current)
 {
 	if ((assist_level_data.level.flags & ASSIST_FLAG_PAS) && (assist_level_data.level.flags & ASSIST_FLAG_PAS_TORQUE))
 	{
-		if (pas_is_pedaling_forwards() && (pas_get_pulse_counter() > g_config.pas_start_delay_pulses || speed_sensor_is_moving()))
+		if (sensors.pas_pedaling_forwards && (sensors.pas_pulse_counter > g_config.pas_start_delay_pulses || sensors.speed_moving))
 		{
-			uint16_t torque_nm_x100 = torque_sensor_get_nm_x100();
-			uint16_t cadence_rpm_x10 = pas_get_cadence_rpm_x10();
+			uint16_t torque_nm_x100 = sensors.torque_nm_x100;
+			uint16_t cadence_rpm_x10 = sensors.pas_cadence_rpm_x10;
 			if (cadence_rpm_x10 < TORQUE_POWER_LOWER_RPM_X10)
 			{
 				cadence_rpm_x10 = TORQUE_POWER_LOWER_RPM_X10;
@@ -442,7 +651,7 @@ void apply_pas_torque(uint8_t* target_current)
 			{
 				target_current_amp_x100 = max_current_amp_x100;
 			}
-			uint8_t tmp_percent = (uint8_t)MAP32(target_current_amp_x100, 0, max_current_amp_x100, 0, 100);
+			uint8_t tmp_percent = (uint8_t)MAP_SLOPE32(target_current_amp_x100, 0, 0, torque_current_slope_x65536);
 
 			// minimum 1 percent current if pedaling
 			if (tmp_percent < 1)
@@ -471,14 +680,14 @@ void apply_cruise(uint8_t* target_current, uint8_t throttle_percent)
 	if ((assist_level_data.level.flags & ASSIST_FLAG_CRUISE) && throttle_ok())
 	{
 		// pause cruise if brake activated
-		if (brake_is_activated())
+		if (sensors.brake)
 		{
 			cruise_paused = true;
 			cruise_block_throttle_return = true;
 		}
 
 		// pause cruise if started pedaling backwards
-		else if (pas_is_pedaling_backwards() && pas_get_pulse_counter() > CRUISE_DISENGAGE_PAS_PULSES)
+		else if (sensors.pas_pedaling_backwards && sensors.pas_pulse_counter > CRUISE_DISENGAGE_PAS_PULSES)
 		{
 			cruise_paused = true;
 			cruise_block_throttle_return = true;
@@ -492,7 +701,7 @@ void apply_cruise(uint8_t* target_current, uint8_t throttle_percent)
 		}
 
 		// unpause cruise if pedaling forward while engaging throttle > 50%
-		else if (cruise_paused && !cruise_block_throttle_return && throttle_percent > 50 && pas_is_pedaling_forwards() && pas_get_pulse_counter() > CRUISE_ENGAGE_PAS_PULSES)
+		else if (cruise_paused && !cruise_block_throttle_return && throttle_percent > 50 && sensors.pas_pedaling_forwards && sensors.pas_pulse_counter > CRUISE_ENGAGE_PAS_PULSES)
 		{
 			cruise_paused = false;
 			cruise_block_throttle_return = true;
@@ -580,7 +789,7 @@ bool apply_speed_limit(uint8_t* target_current, uint8_t throttle_percent, bool p
 
 	if (max_speed_rpm_x10 > 0)
 	{
-		int16_t current_speed_rpm_x10 = speed_sensor_get_rpm_x10();
+		int16_t current_speed_rpm_x10 = sensors.speed_rpm_x10;
 
 		if (current_speed_rpm_x10 < max_speed_ramp_low_rpm_x10)
 		{
@@ -610,7 +819,8 @@ bool apply_speed_limit(uint8_t* target_current, uint8_t throttle_percent, bool p
 			else
 			{
 				// linear ramp down when approaching max speed.
-				uint8_t tmp = (uint8_t)MAP32(current_speed_rpm_x10, max_speed_ramp_low_rpm_x10, max_speed_ramp_high_rpm_x10, *target_current, 1);
+				uint8_t tmp = (uint8_t)MAP_SLOPE32(current_speed_rpm_x10, max_speed_ramp_low_rpm_x10, *target_current,
+					(1 - *target_current) * speed_limit_ramp_inv_x65536);
 				if (*target_current > tmp)
 				{
 					*target_current = tmp;
@@ -632,15 +842,19 @@ bool apply_thermal_limit(uint8_t* target_current)
 	int16_t temp_contr_x100 = temperature_contr_x100();
 	temperature_contr_c = temp_contr_x100 / 100;
 
+#if HAS_MOTOR_TEMP_SENSOR
 	int16_t temp_motor_x100 = temperature_motor_x100();
+#else
+	int16_t temp_motor_x100 = thermal_get_motor_temperature_x100();
+#endif
 	temperature_motor_c = temp_motor_x100 / 100;
 
 	int16_t max_temp_x100 = MAX(temp_contr_x100, temp_motor_x100);
 	int8_t max_temp = MAX(temperature_contr_c, temperature_motor_c);
 
-	if (eventlog_is_enabled() && g_config.use_temperature_sensor && system_ms() > next_log_temp_ms)
+	if (eventlog_is_enabled() && g_config.use_temperature_sensor && sensors.ms > next_log_temp_ms)
 	{
-		next_log_temp_ms = system_ms() + 10000;
+		next_log_temp_ms = sensors.ms + 10000;
 		eventlog_write_data(EVT_DATA_TEMPERATURE, (uint16_t)temperature_motor_c << 8 | temperature_contr_c);
 	}
 
@@ -657,12 +871,11 @@ bool apply_thermal_limit(uint8_t* target_current)
 			max_temp_x100 = MAX_TEMPERATURE * 100;
 		}
 
-		uint8_t tmp = (uint8_t)MAP32(
+		uint8_t tmp = (uint8_t)MAP_SLOPE32(
 			max_temp_x100,													// value
 			(MAX_TEMPERATURE - MAX_TEMPERATURE_RAMP_DOWN_INTERVAL) * 100,	// in_min
-			MAX_TEMPERATURE * 100,											// in_max
 			100,															// out_min
-			MAX_TEMPERATURE_LOW_CURRENT_PERCENT								// out_max
+			thermal_ramp_slope_x65536										// slope
 		);
 
 		if (*target_current > tmp)
@@ -691,19 +904,21 @@ bool apply_low_voltage_limit(uint8_t* target_current)
 	static uint32_t next_voltage_reading_ms = 125;
 	static int32_t flt_min_bat_volt_x100 = 100 * 100;
 
-	if (system_ms() > next_voltage_reading_ms)
+	if (sensors.ms > next_voltage_reading_ms)
 	{
-		next_voltage_reading_ms = system_ms() + 125;
+		next_voltage_reading_ms = sensors.ms + 125;
 		int32_t voltage_reading_x100 = motor_get_battery_voltage_x10() * 10ul;
 
-		if (voltage_reading_x100 < flt_min_bat_volt_x100)
+		// sag compensated voltage if battery resistance is identified
+		int32_t ocv_reading_x100 = battery_get_open_circuit_voltage_x100();
+		if (ocv_reading_x100 < flt_min_bat_volt_x100)
 		{
-			flt_min_bat_volt_x100 = EXPONENTIAL_FILTER(flt_min_bat_volt_x100, voltage_reading_x100, 8);
+			flt_min_bat_volt_x100 = EXPONENTIAL_FILTER(flt_min_bat_volt_x100, ocv_reading_x100, 8);
 		}
 
-		if (eventlog_is_enabled() && system_ms() > next_log_volt_ms)
+		if (eventlog_is_enabled() && sensors.ms > next_log_volt_ms)
 		{
-			next_log_volt_ms = system_ms() + 10000;
+			next_log_volt_ms = sensors.ms + 10000;
 			eventlog_write_data(EVT_DATA_VOLTAGE, (uint16_t)voltage_reading_x100);
 		}
 	}
@@ -724,12 +939,11 @@ bool apply_low_voltage_limit(uint8_t* target_current)
 		}
 
 		// Ramp down power until LVC_LOW_CURRENT_PERCENT when approaching LVC
-		uint8_t tmp = (uint8_t)MAP32(
+		uint8_t tmp = (uint8_t)MAP_SLOPE32(
 			voltage_x100,						// value
 			lvc_ramp_down_end_voltage_x100,		// in_min
-			lvc_ramp_down_start_voltage_x100,	// in_max
 			LVC_LOW_CURRENT_PERCENT,			// out_min
-			100									// out_max
+			lvc_ramp_down_slope_x65536			// slope
 		);
 
 		if (*target_current > tmp)
@@ -742,6 +956,73 @@ bool apply_low_voltage_limit(uint8_t* target_current)
 	return false;
 }
 
+bool apply_low_voltage_floor_limit(uint8_t* target_current)
+{
+	static uint32_t next_update_ms = 0;
+	static uint16_t max_current_x10 = 0xffff;
+	static bool floor_limiting = false;
+
+	uint16_t resistance_mohm = battery_get_resistance_mohm();
+	if (g_config.lvc_floor_margin_x10v == 0 || resistance_mohm == 0)
+	{
+		return false;
+	}
+
+	if (sensors.ms >= next_update_ms)
+	{
+		next_update_ms = sensors.ms + 50;
+
+		// Current which gives floor voltage at estimated open circuit voltage,
+		// I = (V_ocv - V_floor) / R, 0.01V * 100 / mOhm = 0.1A
+		int32_t headroom_x100 = (int32_t)battery_get_open_circuit_voltage_x100() - lvc_floor_voltage_x100;
+		int32_t current_x10 = 0;
+		if (headroom_x100 > 0)
+		{
+			current_x10 = (headroom_x100 * 100) / resistance_mohm;
+			if (current_x10 > 0xffff)
+			{
+				current_x10 = 0xffff;
+			}
+		}
+
+		if (current_x10 < max_current_x10)
+		{
+			max_current_x10 = (uint16_t)current_x10;
+		}
+		else
+		{
+			max_current_x10 = (uint16_t)(EXPONENTIAL_FILTER((int32_t)max_current_x10, current_x10, LVC_FLOOR_RAMP_UP_FILTER));
+		}
+	}
+
+	// target current is percent of configured max current at this stage,
+	// boost scaling is applied later in the pipeline
+	uint16_t max_current_amps_x10 = g_config.max_current_amps * 10u;
+	if (max_current_x10 < max_current_amps_x10)
+	{
+		uint8_t tmp = (uint8_t)((max_current_x10 * 100ul) / max_current_amps_x10);
+		if (*target_current > tmp)
+		{
+			if (!floor_limiting)
+			{
+				floor_limiting = true;
+				eventlog_write_data(EVT_DATA_LVC_FLOOR_LIMITING, max_current_x10 > 0 ? max_current_x10 : 1);
+			}
+
+			*target_current = tmp;
+			return true;
+		}
+	}
+
+	if (floor_limiting)
+	{
+		floor_limiting = false;
+		eventlog_write_data(EVT_DATA_LVC_FLOOR_LIMITING, 0);
+	}
+
+	return false;
+}
+
 #if HAS_SHIFT_SENSOR_SUPPORT
 bool apply_shift_sensor_interrupt(uint8_t* target_current)
 {
@@ -756,7 +1037,7 @@ bool apply_shift_sensor_interrupt(uint8_t* target_current)
 		return false;
 	}
 
-	bool active = shift_sensor_is_activated();
+	bool active = sensors.shift_sensor;
 	if (active)
 	{
 		// Check for new pulse from the gear sensor during shift interrupt
@@ -771,7 +1052,7 @@ bool apply_shift_sensor_interrupt(uint8_t* target_current)
 				g_config.shift_interrupt_duration_ms_u16h,
 				g_config.shift_interrupt_duration_ms_u16l
 			);
-			shift_sensor_act_ms = system_ms() + duration_ms;
+			shift_sensor_act_ms = sensors.ms + duration_ms;
 			shift_sensor_interrupting = true;
 		}
 		shift_sensor_last = true;
@@ -786,7 +1067,7 @@ bool apply_shift_sensor_interrupt(uint8_t* target_current)
 		return false;
 	}
 
-	if (system_ms() >= shift_sensor_act_ms)
+	if (sensors.ms >= shift_sensor_act_ms)
 	{
 		// Shift is finished, reset function state.
 		shift_sensor_interrupting = false;
@@ -817,9 +1098,74 @@ bool apply_shift_sensor_interrupt(uint8_t* target_current)
 }
 #endif
 
+bool apply_power_limit(uint8_t* target_current)
+{
+	static uint32_t next_update_ms = 0;
+	static uint8_t max_percent = 100;
+	static bool power_limiting = false;
+
+	if (assist_level_data.max_power_w == 0)
+	{
+		power_limit_integral_x256 = 100 * 256l;
+		max_percent = 100;
+		return false;
+	}
+
+	if (sensors.ms >= next_update_ms)
+	{
+		next_update_ms = sensors.ms + POWER_LIMIT_INTERVAL_MS;
+
+		int32_t power_w = ((int32_t)motor_get_battery_voltage_x10() * motor_get_battery_current_x10()) / 100;
+		int32_t error_w = (int32_t)assist_level_data.max_power_w - power_w;
+
+		// integral clamped to output range (anti windup)
+		power_limit_integral_x256 += error_w * POWER_LIMIT_KI_X256;
+		if (power_limit_integral_x256 > 100 * 256l)
+		{
+			power_limit_integral_x256 = 100 * 256l;
+		}
+		else if (power_limit_integral_x256 < 0)
+		{
+			power_limit_integral_x256 = 0;
+		}
+
+		int32_t output_x256 = power_limit_integral_x256 + error_w * POWER_LIMIT_KP_X256;
+		if (output_x256 > 100 * 256l)
+		{
+			output_x256 = 100 * 256l;
+		}
+		else if (output_x256 < 256)
+		{
+			// keep motor running, limit is regulated from battery current
+			output_x256 = 256;
+		}
+
+		max_percent = (uint8_t)(output_x256 / 256);
+	}
+
+	if (*target_current > max_percent)
+	{
+		if (!power_limiting)
+		{
+			power_limiting = true;
+			eventlog_write_data(EVT_DATA_POWER_LIMITING, assist_level_data.max_power_w);
+		}
+
+		*target_current = max_percent;
+		return true;
+	}
+	else if (power_limiting && max_percent == 100)
+	{
+		power_limiting = false;
+		eventlog_write_data(EVT_DATA_POWER_LIMITING, 0);
+	}
+
+	return false;
+}
+
 bool apply_brake(uint8_t* target_current)
 {
-	bool is_braking = brake_is_activated();
+	bool is_braking = sensors.brake;
 
 	if (g_config.lights_mode == LIGHTS_MODE_BRAKE_LIGHT)
 	{
@@ -834,6 +1180,63 @@ bool apply_brake(uint8_t* target_current)
 	return is_braking;
 }
 
+void apply_boost(uint8_t* target_current, bool enable)
+{
+	static uint32_t next_update_ms = 0;
+
+	if (boost_budget_max_x100 == 0)
+	{
+		// disabled, target is percent of max current
+		return;
+	}
+
+	if (sensors.ms >= next_update_ms)
+	{
+		next_update_ms = sensors.ms + 100;
+
+		// budget is used above max current and refilled below
+		int32_t current_x10 = motor_get_battery_current_x10();
+		boost_budget_x100 -= (current_x10 * current_x10 -
+			(int32_t)boost_continuous_current_x10 * boost_continuous_current_x10) / 10;
+
+		if (boost_budget_x100 < 0)
+		{
+			boost_budget_x100 = 0;
+		}
+		else if (boost_budget_x100 > boost_budget_max_x100)
+		{
+			boost_budget_x100 = boost_budget_max_x100;
+		}
+
+		uint8_t percent = (uint8_t)(boost_budget_x100 / (boost_budget_max_x100 / 100 + 1));
+		if (percent / 10 != boost_budget_percent / 10)
+		{
+			eventlog_write_data(EVT_DATA_BOOST_BUDGET, percent);
+		}
+		boost_budget_percent = percent;
+	}
+
+	// target is percent of max current, motor is configured with boost current
+	uint8_t max_percent = boost_continuous_percent;
+	if (enable)
+	{
+		if (boost_budget_percent >= BOOST_BUDGET_RAMP_DOWN_PERCENT)
+		{
+			max_percent = 100;
+		}
+		else
+		{
+			max_percent += (uint8_t)(((100u - boost_continuous_percent) * boost_budget_percent) / BOOST_BUDGET_RAMP_DOWN_PERCENT);
+		}
+	}
+
+	if (*target_current > 0)
+	{
+		uint8_t tmp = (uint8_t)(((uint16_t)*target_current * max_percent) / 100);
+		*target_current = tmp > 0 ? tmp : 1;
+	}
+}
+
 void apply_current_ramp_up(uint8_t* target_current, bool enable)
 {
 	static uint8_t ramp_up_target_current = 0;
@@ -841,7 +1244,7 @@ void apply_current_ramp_up(uint8_t* target_current, bool enable)
 
 	if (enable && *target_current > ramp_up_target_current)
 	{
-		uint32_t now = system_ms();
+		uint32_t now = sensors.ms;
 		uint16_t time_diff = now - last_ramp_up_increment_ms;
 
 		if (time_diff >= ramp_up_current_interval_ms)
@@ -876,7 +1279,7 @@ void apply_current_ramp_down(uint8_t* target_current, bool enable)
 	// apply fast ramp down if coming from high target current (> 50%)
 	if (enable && *target_current < ramp_down_target_current)
 	{
-		uint32_t now = system_ms();
+		uint32_t now = sensors.ms;
 		uint16_t time_diff = now - last_ramp_down_decrement_ms;
 
 		if (time_diff >= 10)
@@ -918,7 +1321,7 @@ bool check_power_block()
 	if (power_blocked_until_ms != 0)
 	{
 		// power block is active, check if time to release
-		if (system_ms() > power_blocked_until_ms)
+		if (sensors.ms > power_blocked_until_ms)
 		{
 			power_blocked_until_ms = 0;
 			return false;
@@ -930,6 +1333,45 @@ bool check_power_block()
 	return false;
 }
 
+void trace_begin(uint8_t requested_current)
+{
+	trace.requested_current = requested_current;
+	trace.reduced_flags = 0;
+	trace_last_current = requested_current;
+}
+
+void trace_stage(uint8_t stage, uint8_t target_current)
+{
+	trace.stage_current[stage] = target_current;
+	if (target_current < trace_last_current)
+	{
+		trace.reduced_flags |= (1 << stage);
+	}
+	trace_last_current = target_current;
+}
+
+void trace_end(uint8_t target_current)
+{
+	trace_history_reduced_flags |= trace.reduced_flags;
+
+	if (sensors.ms >= trace_history_next_ms)
+	{
+		trace_history_next_ms = sensors.ms + TRACE_HISTORY_INTERVAL_MS;
+
+		app_trace_history_t* entry = &trace_history[trace_history_next];
+		entry->requested_current = trace.requested_current;
+		entry->target_current = target_current;
+		entry->reduced_flags = trace_history_reduced_flags;
+		trace_history_reduced_flags = 0;
+
+		trace_history_next = (trace_history_next + 1) % TRACE_HISTORY_SIZE;
+		if (trace_history_count < TRACE_HISTORY_SIZE)
+		{
+			++trace_history_count;
+		}
+	}
+}
+
 void block_power_for(uint16_t ms)
 {
 	power_blocked_until_ms = system_ms() + ms;
@@ -948,8 +1390,17 @@ void reload_assist_params()
 			assist_level_data.keep_current_target_percent = (uint8_t)((uint16_t)g_config.pas_keep_current_percent * assist_level_data.level.target_current_percent / 100);
 			assist_level_data.keep_current_ramp_start_rpm_x10 = g_config.pas_keep_current_cadence_rpm * 10;
 			assist_level_data.keep_current_ramp_end_rpm_x10 = (uint16_t)(((uint32_t)assist_level_data.level.max_cadence_percent * MAX_CADENCE_RPM_X10) / 100);
+
+			assist_level_data.keep_current_ramp_inv_x65536 = 0;
+			if (assist_level_data.keep_current_ramp_end_rpm_x10 > assist_level_data.keep_current_ramp_start_rpm_x10)
+			{
+				assist_level_data.keep_current_ramp_inv_x65536 = SLOPE_X65536(
+					assist_level_data.keep_current_ramp_end_rpm_x10 - assist_level_data.keep_current_ramp_start_rpm_x10, 1);
+			}
 		}
 
+		assist_level_data.max_power_w = assist_level_data.level.max_power_w_div10 * 10u;
+
 		// pause cruise if swiching level
 		cruise_paused = true;
 	}
@@ -962,9 +1413,79 @@ void reload_assist_params()
 		assist_level_data.level.max_speed_percent = 0;
 		assist_level_data.level.max_cadence_percent = 15;
 		assist_level_data.level.max_throttle_current_percent = 0;
+		assist_level_data.level.max_power_w_div10 = 0;
 
 		assist_level_data.max_wheel_speed_rpm_x10 = convert_wheel_speed_kph_to_rpm(WALK_MODE_SPEED_KPH) * 10;
+		assist_level_data.max_power_w = 0;
+	}
+
+	if (assist_level_data.max_power_w == 0)
+	{
+		// power limit stage is skipped, start unlimited when enabled again
+		power_limit_integral_x256 = 100 * 256l;
+	}
+
+	uint16_t stages = get_active_stages();
+	if (stages != assist_level_data.stages)
+	{
+		assist_level_data.stages = stages;
+		eventlog_write_data(EVT_DATA_ASSIST_STAGES, stages);
+	}
+}
+
+uint16_t get_active_stages()
+{
+	uint16_t stages = 0;
+	uint8_t flags = assist_level_data.level.flags;
+
+	// apply_speed_limit() does nothing without speed sensor, this includes
+	// global throttle speed limit, cadence limit is not part of this stage
+	if (g_config.use_speed_sensor)
+	{
+		stages |= STAGE_SPEED_LIMIT;
+
+		if (g_config.use_pretension)
+		{
+			stages |= STAGE_PRETENSION;
+		}
+	}
+
+	if (flags & ASSIST_FLAG_PAS)
+	{
+		stages |= (flags & ASSIST_FLAG_PAS_TORQUE) ? STAGE_PAS_TORQUE : STAGE_PAS_CADENCE;
+	}
+
+	if (flags & ASSIST_FLAG_CRUISE)
+	{
+		stages |= STAGE_CRUISE;
+	}
+
+	if (flags & ASSIST_FLAG_THROTTLE)
+	{
+		stages |= STAGE_THROTTLE;
+	}
+
+	if (g_config.lvc_floor_margin_x10v > 0)
+	{
+		stages |= STAGE_LVC_FLOOR;
+	}
+
+	if (g_config.use_shift_sensor)
+	{
+		stages |= STAGE_SHIFT_SENSOR;
 	}
+
+	if (assist_level_data.max_power_w > 0)
+	{
+		stages |= STAGE_POWER_LIMIT;
+	}
+
+	if (boost_budget_max_x100 > 0)
+	{
+		stages |= STAGE_BOOST;
+	}
+
+	return stages;
 }
 
 uint16_t convert_wheel_speed_kph_to_rpm(uint8_t speed_kph)
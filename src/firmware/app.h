@@ -29,6 +29,40 @@
 #define OPERATION_MODE_DEFAULT	0x00
 #define OPERATION_MODE_SPORT	0x01
 
+#define LIMITING_FLAG_SPEED		0x01
+#define LIMITING_FLAG_THERMAL	0x02
+#define LIMITING_FLAG_LVC		0x04
+#define LIMITING_FLAG_SHIFT		0x08
+#define LIMITING_FLAG_POWER		0x10
+#define LIMITING_FLAG_BRAKE		0x20	// trace only
+#define LIMITING_FLAG_BOOST		0x40	// trace only
+#define LIMITING_FLAG_RAMP		0x80	// trace only
+
+// Current trace stage, bit index of matching LIMITING_FLAG_*
+#define TRACE_STAGE_SPEED		0
+#define TRACE_STAGE_THERMAL		1
+#define TRACE_STAGE_LVC			2
+#define TRACE_STAGE_SHIFT		3
+#define TRACE_STAGE_POWER		4
+#define TRACE_STAGE_BRAKE		5
+#define TRACE_STAGE_BOOST		6
+#define TRACE_STAGE_RAMP		7
+#define TRACE_NUM_STAGES		8
+
+typedef struct
+{
+	uint8_t requested_current;					// percent, before limiting stages
+	uint8_t stage_current[TRACE_NUM_STAGES];	// percent, after each stage
+	uint8_t reduced_flags;						// LIMITING_FLAG_* of stages reducing current
+} app_trace_t;
+
+typedef struct
+{
+	uint8_t requested_current;
+	uint8_t target_current;
+	uint8_t reduced_flags;						// all stages reducing current within interval
+} app_trace_history_t;
+
 // Matches status codes used by Bafang
 #define STATUS_NORMAL						0x01
 #define STATUS_BRAKING						0x03
@@ -58,6 +92,9 @@ void app_init();
 
 void app_process();
 
+// input event pending which should trigger app_process
+bool app_event_pending();
+
 void app_set_assist_level(uint8_t level);
 void app_set_lights(bool on);
 
@@ -69,4 +106,17 @@ uint8_t app_get_lights();
 uint8_t app_get_status_code();
 uint8_t app_get_temperature();
 
+// LIMITING_FLAG_* of limiters reducing current in last app_process
+uint8_t app_get_limiting_flags();
+
+// Current trace of last app_process and decimated history,
+// history index 0 is the oldest entry.
+const app_trace_t* app_get_trace();
+uint8_t app_get_trace_history_count();
+const app_trace_history_t* app_get_trace_history(uint8_t index);
+
+// max current configured in motor, boost current if enabled
+uint8_t app_get_max_current_amps();
+uint8_t app_get_boost_budget_percent();
+
 #endif
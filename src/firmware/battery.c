@@ -8,9 +8,11 @@
 
 #include "battery.h"
 #include "motor.h"
+#include "usage.h"
 #include "system.h"
 #include "util.h"
 #include "cfgstore.h"
+#include "eventlog.h"
 #include "fwconfig.h"
 
 static int16_t battery_empty_x100v;
@@ -20,16 +22,32 @@ static uint8_t battery_percent;
 static uint32_t motor_disabled_at_ms;
 static bool first_reading_done;
 
-/*
-No attempt is made to have accurate battery state of charge display.
+static uint32_t capacity_mas_div100;
+static int32_t used_charge_mas;
+static int32_t used_energy_j;
+static int32_t used_energy_mj_rem;
+static uint32_t last_energy_mj;
+static uint16_t saved_charge_mah;
+static bool no_load_anchored;
+static uint32_t next_count_ms;
+
+static uint16_t resistance_mohm;
+static uint16_t saved_resistance_mohm;
+static uint16_t prev_voltage_x10;
+static uint16_t prev_current_x10;
 
-This is only a voltage based approch using configured max and min battery voltages.
+/*
+Voltage based SOC uses configured max and min battery voltages.
 The end values are padded 8% on each side (BATTERY_EMPTY_OFFSET_PERCENT, BATTERY_FULL_OFFSET_PERCENT).
 
 Battery voltage is measured when no motor power has been applied for
 at least 2 seconds (BATTERY_NO_LOAD_DELAY_MS). This is to mitigate measuring voltage sag
 but is still problematic in cold weather.
 
+Once the internal resistance of the battery has been estimated, from the voltage
+change over load steps (R = -dV / dI), the open circuit equivalent voltage
+(V + I * R) is used instead. SOC can then also be lowered while under load.
+
 Battery SOC percentage is calculated from measured voltage using linear interpolation
 between the padded ranges.
 
@@ -44,16 +62,131 @@ For example, if the maximum battery voltage is 58.8V and the low cutoff voltage
 - The battery is considered at   0% SOC at 42.0V + 1.3V = 43.3V
 - LVC rampdown will start at 10% SOC, so: 43.3V + 0.1 * (57.5V - 43.3V) = 44.7V
 - Full LVC limiting will occur at 0% SOC, so: 43.3V
+
+If battery capacity is configured, SOC is instead computed from counted battery
+current (coulomb counting) which is accurate under load and in cold weather.
+The count is anchored to voltage SOC when there is no load, fully at startup if
+the difference is large (battery charged while off), otherwise slowly
+(BATTERY_SOC_ANCHOR_FILTER) once for every no load period.
+
+Used charge and energy are persisted (wear levelled) when motor is idle.
 */
 
 static uint8_t compute_battery_percent()
 {
-	int16_t value_x100v = motor_get_battery_voltage_x10() * 10l;
+	int16_t value_x100v = battery_get_open_circuit_voltage_x100();
 	int16_t percent = (int16_t)MAP32(value_x100v, battery_empty_x100v, battery_full_x100v, 0, 100);
 
 	return (uint8_t)CLAMP(percent, 0, 100);
 }
 
+static uint8_t compute_counted_percent()
+{
+	int32_t percent = 100 - (int32_t)(used_charge_mas / capacity_mas_div100);
+
+	return (uint8_t)CLAMP(percent, 0, 100);
+}
+
+static void set_used_charge(int32_t value_mas)
+{
+	// adjust energy with charge difference at current voltage
+	int32_t diff_as = (value_mas - used_charge_mas) / 1000;
+	used_energy_j += (diff_as * motor_get_battery_voltage_x10()) / 10;
+	used_charge_mas = value_mas;
+
+	if (used_charge_mas < 0)
+	{
+		used_charge_mas = 0;
+	}
+
+	if (used_energy_j < 0)
+	{
+		used_energy_j = 0;
+	}
+}
+
+static void anchor_to_voltage(uint8_t voltage_percent, uint8_t filter)
+{
+	if (voltage_percent >= 100)
+	{
+		// full, reset counters
+		used_charge_mas = 0;
+		used_energy_j = 0;
+	}
+	else if (capacity_mas_div100 > 0)
+	{
+		int32_t target_mas = (int32_t)(100 - voltage_percent) * capacity_mas_div100;
+		set_used_charge(used_charge_mas + (target_mas - used_charge_mas) / filter);
+	}
+}
+
+static void save_counters()
+{
+	uint16_t charge_mah = battery_get_used_mah();
+	uint16_t energy_wh = battery_get_used_wh();
+
+	g_bstate.used_charge_mah_u16l = (uint8_t)charge_mah;
+	g_bstate.used_charge_mah_u16h = (uint8_t)(charge_mah >> 8);
+	g_bstate.used_energy_wh_u16l = (uint8_t)energy_wh;
+	g_bstate.used_energy_wh_u16h = (uint8_t)(energy_wh >> 8);
+	g_bstate.internal_resistance_mohm_u16l = (uint8_t)resistance_mohm;
+	g_bstate.internal_resistance_mohm_u16h = (uint8_t)(resistance_mohm >> 8);
+
+	cfgstore_save_bstate();
+	saved_charge_mah = charge_mah;
+
+	if (resistance_mohm != saved_resistance_mohm)
+	{
+		saved_resistance_mohm = resistance_mohm;
+		eventlog_write_data(EVT_DATA_BATTERY_RESISTANCE, resistance_mohm);
+	}
+}
+
+static void estimate_resistance()
+{
+	// called every 100ms
+	uint16_t voltage_x10 = motor_get_battery_voltage_x10();
+	uint16_t current_x10 = motor_get_battery_current_x10();
+
+	int16_t diff_current_x10 = (int16_t)(current_x10 - prev_current_x10);
+	if (diff_current_x10 >= BATTERY_RESISTANCE_MIN_STEP_X10 || diff_current_x10 <= -BATTERY_RESISTANCE_MIN_STEP_X10)
+	{
+		// voltage drops when current increases
+		int32_t value_mohm = ((int32_t)((int16_t)(prev_voltage_x10 - voltage_x10)) * 1000) / diff_current_x10;
+
+		if (value_mohm >= BATTERY_RESISTANCE_MIN_MOHM && value_mohm <= BATTERY_RESISTANCE_MAX_MOHM)
+		{
+			if (resistance_mohm == 0)
+			{
+				resistance_mohm = (uint16_t)value_mohm;
+			}
+			else
+			{
+				resistance_mohm = (uint16_t)(EXPONENTIAL_FILTER((int32_t)resistance_mohm, value_mohm, BATTERY_RESISTANCE_FILTER));
+			}
+		}
+	}
+
+	prev_voltage_x10 = voltage_x10;
+	prev_current_x10 = current_x10;
+}
+
+static void count_usage()
+{
+	// called every 100ms, 0.1A * 0.1s = 10mAs, energy from usage counter
+	uint16_t current_x10 = motor_get_battery_current_x10();
+	uint32_t energy_mj = usage_get_energy_mj();
+
+	used_charge_mas += current_x10 * 10l;
+	used_energy_mj_rem += (int32_t)(energy_mj - last_energy_mj);
+	last_energy_mj = energy_mj;
+	if (used_energy_mj_rem >= 1000)
+	{
+		used_energy_j += used_energy_mj_rem / 1000;
+		used_energy_mj_rem %= 1000;
+	}
+}
+
 #if (BATTERY_PERCENT_MAP == BATTERY_PERCENT_MAP_SW102)
 static uint8_t map_percent_sw102(uint8_t percent)
 {
@@ -112,6 +245,36 @@ void battery_init()
 
 	battery_empty_x100v = battery_min_voltage_x100v +
 		((BATTERY_EMPTY_OFFSET_PERCENT * battery_range_x100v) / 100);
+
+	// 0.1Ah = 360000mAs
+	capacity_mas_div100 = EXPAND_U16(g_config.battery_capacity_x10ah_u16h, g_config.battery_capacity_x10ah_u16l) * 3600ul;
+
+	used_charge_mas = 0;
+	used_energy_j = 0;
+	used_energy_mj_rem = 0;
+	last_energy_mj = usage_get_energy_mj();
+	no_load_anchored = false;
+	next_count_ms = 0;
+
+	resistance_mohm = 0;
+	prev_voltage_x10 = 0;
+	prev_current_x10 = 0;
+
+	if (cfgstore_read_bstate())
+	{
+		used_charge_mas = EXPAND_U16(g_bstate.used_charge_mah_u16h, g_bstate.used_charge_mah_u16l) * 3600l;
+		used_energy_j = EXPAND_U16(g_bstate.used_energy_wh_u16h, g_bstate.used_energy_wh_u16l) * 3600l;
+		resistance_mohm = EXPAND_U16(g_bstate.internal_resistance_mohm_u16h, g_bstate.internal_resistance_mohm_u16l);
+
+		// discard estimate saved with a wider accepted range
+		if (resistance_mohm > BATTERY_RESISTANCE_MAX_MOHM)
+		{
+			resistance_mohm = 0;
+		}
+	}
+
+	saved_charge_mah = battery_get_used_mah();
+	saved_resistance_mohm = resistance_mohm;
 }
 
 void battery_process()
@@ -122,12 +285,40 @@ void battery_process()
 		{
 			battery_percent = compute_battery_percent();
 			first_reading_done = true;
+
+			int16_t diff_percent = 100;
+			if (capacity_mas_div100 > 0)
+			{
+				diff_percent = (int16_t)compute_counted_percent() - battery_percent;
+			}
+
+			if (diff_percent > BATTERY_SOC_RESYNC_PERCENT || diff_percent < -BATTERY_SOC_RESYNC_PERCENT)
+			{
+				anchor_to_voltage(battery_percent, 1);
+			}
+
+			if (capacity_mas_div100 > 0)
+			{
+				battery_percent = compute_counted_percent();
+			}
+
+			if (battery_get_used_mah() != saved_charge_mah)
+			{
+				save_counters();
+			}
 		}
 	}
 	else
 	{
 		uint8_t target_current = motor_get_target_current();
 
+		if (system_ms() >= next_count_ms)
+		{
+			next_count_ms = system_ms() + 100;
+			count_usage();
+			estimate_resistance();
+		}
+
 		if (motor_disabled_at_ms == 0 && target_current == 0)
 		{
 			motor_disabled_at_ms = system_ms();
@@ -135,11 +326,46 @@ void battery_process()
 		else if (target_current > 0)
 		{
 			motor_disabled_at_ms = 0;
+			no_load_anchored = false;
 		}
 
 		if (target_current == 0 && (system_ms() - motor_disabled_at_ms) > BATTERY_NO_LOAD_DELAY_MS)
 		{
-			battery_percent = compute_battery_percent();
+			uint8_t voltage_percent = compute_battery_percent();
+
+			if (!no_load_anchored)
+			{
+				no_load_anchored = true;
+				anchor_to_voltage(voltage_percent, BATTERY_SOC_ANCHOR_FILTER);
+
+				uint16_t charge_mah = battery_get_used_mah();
+				if (charge_mah > saved_charge_mah + BATTERY_SOC_SAVE_DELTA_MAH ||
+					charge_mah + BATTERY_SOC_SAVE_DELTA_MAH < saved_charge_mah ||
+					resistance_mohm > saved_resistance_mohm + BATTERY_RESISTANCE_SAVE_DELTA_MOHM ||
+					resistance_mohm + BATTERY_RESISTANCE_SAVE_DELTA_MOHM < saved_resistance_mohm)
+				{
+					save_counters();
+				}
+			}
+
+			if (capacity_mas_div100 == 0)
+			{
+				battery_percent = voltage_percent;
+			}
+		}
+		else if (capacity_mas_div100 == 0 && resistance_mohm > 0)
+		{
+			// sag compensated, only allow decrease under load
+			uint8_t voltage_percent = compute_battery_percent();
+			if (voltage_percent < battery_percent)
+			{
+				battery_percent = voltage_percent;
+			}
+		}
+
+		if (capacity_mas_div100 > 0)
+		{
+			battery_percent = compute_counted_percent();
 		}
 	}
 }
@@ -157,3 +383,42 @@ uint8_t battery_get_mapped_percent()
 	return battery_percent;
 #endif
 }
+
+uint16_t battery_get_used_mah()
+{
+	return (uint16_t)(used_charge_mas / 3600);
+}
+
+uint16_t battery_get_used_wh()
+{
+	return (uint16_t)(used_energy_j / 3600);
+}
+
+uint16_t battery_get_resistance_mohm()
+{
+	return resistance_mohm;
+}
+
+uint16_t battery_get_open_circuit_voltage_x100()
+{
+	// 0.1A * mOhm / 100 = 0.01V
+	uint32_t drop_x100v = ((uint32_t)motor_get_battery_current_x10() * resistance_mohm) / 100;
+	if (drop_x100v > BATTERY_RESISTANCE_MAX_COMPENSATION_X100V)
+	{
+		drop_x100v = BATTERY_RESISTANCE_MAX_COMPENSATION_X100V;
+	}
+
+	return motor_get_battery_voltage_x10() * 10u + (uint16_t)drop_x100v;
+}
+
+uint16_t battery_get_remaining_wh()
+{
+	int32_t remaining_as = (int32_t)(capacity_mas_div100 / 10) - used_charge_mas / 1000;
+	if (remaining_as <= 0)
+	{
+		return 0;
+	}
+
+	// As * 0.1V / 36000 = Wh
+	return (uint16_t)((remaining_as * motor_get_battery_voltage_x10()) / 36000);
+}
@@ -17,4 +17,17 @@ void battery_process();
 uint8_t battery_get_percent();
 uint8_t battery_get_mapped_percent();
 
+uint16_t battery_get_used_mah();
+uint16_t battery_get_used_wh();
+
+// Remaining energy at present voltage, 0 if capacity not configured.
+uint16_t battery_get_remaining_wh();
+
+// Estimated internal resistance, 0 if not yet identified.
+uint16_t battery_get_resistance_mohm();
+
+// Open circuit equivalent voltage, measured voltage compensated for
+// sag using estimated internal resistance (if identified).
+uint16_t battery_get_open_circuit_voltage_x100();
+
 #endif
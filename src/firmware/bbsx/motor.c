@@ -45,6 +45,12 @@
 
 #define SPEED_STEPS					250
 
+// Crank cadence per volt at full duty cycle, approximate no load speed.
+// Used to estimate duty cycle which is not reported by motor controller.
+// Motor runs at or above crank cadence when assisting, so estimate is
+// never higher than actual duty cycle (phase current overestimated).
+#define CRANK_RPM_PER_VOLT_X10		25
+
 // async om state machine
 #define COM_STATE_IDLE				0x01
 #define COM_STATE_WAIT_RESPONSE		0x02
@@ -243,6 +249,17 @@ int16_t motor_calibrate_battery_voltage(uint16_t actual_voltage_x100)
 	return diff;
 }
 
+bool motor_start_calibration()
+{
+	// rotor position is handled by the motor controller mcu
+	return false;
+}
+
+void motor_set_fast_current_ramp(bool enable)
+{
+	// current ramp is applied in app
+}
+
 
 uint16_t motor_get_battery_lvc_x10()
 {
@@ -259,6 +276,20 @@ uint16_t motor_get_battery_voltage_x10()
 	return battery_volt_x10;
 }
 
+uint8_t motor_get_duty_cycle_percent()
+{
+	// not reported by motor controller, estimated from back-emf
+	// at crank cadence, 0 when not pedaling (e.g. throttle only)
+	uint32_t full_duty_rpm_x10 = ((uint32_t)CRANK_RPM_PER_VOLT_X10 * battery_volt_x10) / 10;
+	if (full_duty_rpm_x10 == 0)
+	{
+		return 0;
+	}
+
+	uint32_t duty = ((uint32_t)pas_get_cadence_rpm_x10() * 100) / full_duty_rpm_x10;
+	return duty > 100 ? 100 : (uint8_t)duty;
+}
+
 static uint8_t compute_checksum(uint8_t* msg, uint8_t len)
 {
 	uint8_t checksum = 0;
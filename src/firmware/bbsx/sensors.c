@@ -76,10 +76,14 @@ static bool pas_prev2;
 static uint16_t pas_stop_delay_periods;
 
 static volatile uint16_t speed_ticks_period_length; // pulse length counted in interrupt frequency (100us)
+static volatile uint16_t speed_pulse_counter;
 static uint16_t speed_period_counter;
 static bool speed_prev_state;
 static uint8_t speed_ticks_per_rpm;
 
+static volatile bool event_pending;
+static bool brake_prev_state;
+
 
 static float thermistor_ntc_calculate_temperature(float R, float invBeta)
 {
@@ -139,8 +143,10 @@ void sensors_init()
 	pas_stop_delay_periods = 1500;
 	speed_period_counter = 0;
 	speed_ticks_period_length = 0;
+	speed_pulse_counter = 0;
 	speed_prev_state = false;
 	speed_ticks_per_rpm = 1;
+	event_pending = false;
 
 	// pins do not have external interrupt, use timer0 to evaluate state frequently
 	SET_PIN_INPUT(PIN_PAS1);
@@ -152,6 +158,7 @@ void sensors_init()
 
 	pas_prev1 = GET_PIN_STATE(PIN_PAS1);
 	pas_prev2 = GET_PIN_STATE(PIN_PAS2);
+	brake_prev_state = GET_PIN_STATE(PIN_BRAKE);
 
 	timer0_init_sensors();
 }
@@ -161,6 +168,58 @@ void sensors_process()
 
 }
 
+void sensors_snapshot(sensors_snapshot_t* snapshot)
+{
+	uint16_t pas_period;
+	bool pas_backward;
+	uint16_t speed_period;
+
+	ET0 = 0; // disable timer0 interrupts
+	pas_period = pas_period_length;
+	pas_backward = pas_direction_backward;
+	snapshot->pas_pulse_counter = pas_pulse_counter;
+	speed_period = speed_ticks_period_length;
+	snapshot->speed_pulse_counter = speed_pulse_counter;
+	ET0 = 1;
+
+	if (pas_period > 0)
+	{
+		snapshot->pas_cadence_rpm_x10 = (uint16_t)((6000000ul / PAS_SENSOR_NUM_SIGNALS) / pas_period);
+	}
+	else
+	{
+		snapshot->pas_cadence_rpm_x10 = 0;
+	}
+	snapshot->pas_pedaling_forwards = pas_period > 0 && !pas_backward;
+	snapshot->pas_pedaling_backwards = pas_period > 0 && pas_backward;
+
+	if (speed_period > 0)
+	{
+		snapshot->speed_rpm_x10 = 6000000ul / speed_period / speed_ticks_per_rpm;
+	}
+	else
+	{
+		snapshot->speed_rpm_x10 = 0;
+	}
+	snapshot->speed_moving = speed_period > 0;
+
+	snapshot->torque_nm_x100 = torque_sensor_get_nm_x100();
+	snapshot->brake = brake_is_activated();
+	snapshot->shift_sensor = shift_sensor_is_activated();
+	snapshot->ms = system_ms();
+}
+
+bool sensors_event_pending()
+{
+	bool tmp;
+	ET0 = 0; // disable timer0 interrupts
+	tmp = event_pending;
+	event_pending = false;
+	ET0 = 1;
+
+	return tmp;
+}
+
 void pas_set_stop_delay(uint16_t delay_ms)
 {
 	pas_stop_delay_periods = delay_ms * 10;
@@ -248,6 +307,16 @@ uint16_t speed_sensor_get_rpm_x10()
 	return 0;
 }
 
+uint16_t speed_sensor_get_pulse_counter()
+{
+	uint16_t tmp;
+	ET0 = 0; // disable timer0 interrupts
+	tmp = speed_pulse_counter;
+	ET0 = 1;
+
+	return tmp;
+}
+
 uint16_t torque_sensor_get_nm_x100()
 {
 	return 0;
@@ -370,6 +439,7 @@ void sensors_timer0_isr() // runs every 100us, see timers.c
 		if (pas1 && !pas_prev1 /* && pas_period_counter > PAS_SENSOR_MIN_PULSE_MS_X10 */)
 		{
 			pas_pulse_counter++;
+			event_pending = true;
 
 			if (pas_direction_backward != pas2)
 			{
@@ -415,12 +485,25 @@ void sensors_timer0_isr() // runs every 100us, see timers.c
 	}
 
 
+	// Brake
+	{
+		bool brake = GET_PIN_STATE(PIN_BRAKE);
+		if (brake != brake_prev_state)
+		{
+			brake_prev_state = brake;
+			event_pending = true;
+		}
+	}
+
+
 	// Speed sensor
 	{
 		bool spd = GET_PIN_STATE(PIN_SPEED_SENSOR);
 
 		if (spd && !speed_prev_state && speed_period_counter > SPEED_SENSOR_MIN_PULSE_MS_X10)
 		{
+			++speed_pulse_counter;
+
 			if (speed_period_counter <= SPEED_SENSOR_TIMEOUT_MS_X10)
 			{
 				speed_ticks_period_length = speed_period_counter;
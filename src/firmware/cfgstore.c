@@ -16,6 +16,16 @@
 
 #define EEPROM_CONFIG_PAGE		0
 #define EEPROM_PSTATE_PAGE		1
+#define EEPROM_BSTATE_PAGE		2
+#define EEPROM_STATS_PAGE		3
+
+// pstate version 1 only contained adc voltage calibration
+#define PSTATE_V1_VERSION		1
+#define PSTATE_V1_SIZE			2
+
+// Smallest eeprom page size of supported targets, wear levelled
+// pages are written as a log of records within this size.
+#define EEPROM_WL_PAGE_SIZE		256
 
 #define EEPROM_OK					0
 #define EEPROM_ERROR_SELECT_PAGE	1
@@ -39,14 +49,37 @@ typedef struct
 	uint8_t checksum;
 } header_t;
 
+typedef struct
+{
+	uint8_t version;
+	uint8_t sequence;
+	uint8_t checksum;
+} wl_header_t;
+
+typedef struct
+{
+	uint8_t page;
+	uint8_t version;
+	uint8_t next_slot;
+	uint8_t next_sequence;
+} wl_page_t;
+
 static header_t header;
+static wl_header_t wl_header;
+static wl_page_t bstate_page;
+static wl_page_t stats_page;
 
 config_t g_config;
 pstate_t g_pstate;
+bstate_t g_bstate;
+stats_t g_stats;
 
 static uint8_t read(uint8_t page, uint8_t version, uint8_t* dst, uint8_t size);
 static uint8_t write(uint8_t page, uint8_t version, uint8_t* src, uint8_t size);
 
+static uint8_t read_wl(wl_page_t* wl, uint8_t* dst, uint8_t size);
+static uint8_t write_wl(wl_page_t* wl, uint8_t* src, uint8_t size);
+
 static bool read_config();
 static bool write_config();
 static void load_default_config();
@@ -66,6 +99,16 @@ void cfgstore_init()
 	{
 		cfgstore_reset_pstate();
 	}
+
+	bstate_page.page = EEPROM_BSTATE_PAGE;
+	bstate_page.version = BSTATE_VERSION;
+	bstate_page.next_slot = 0;
+	bstate_page.next_sequence = 0;
+
+	stats_page.page = EEPROM_STATS_PAGE;
+	stats_page.version = STATS_VERSION;
+	stats_page.next_slot = 0;
+	stats_page.next_sequence = 0;
 }
 
 bool cfgstore_reset_config()
@@ -96,6 +139,76 @@ bool cfgstore_save_pstate()
 	return write_pstate();
 }
 
+bool cfgstore_read_bstate()
+{
+	uint8_t res = read_wl(&bstate_page, (uint8_t*)&g_bstate, sizeof(bstate_t));
+	if (res != EEPROM_OK)
+	{
+		// version error if no record has been written yet
+		if (res != EEPROM_ERROR_VERSION)
+		{
+			eventlog_write(EVT_ERROR_EEPROM_READ);
+		}
+
+		memset(&g_bstate, 0, sizeof(bstate_t));
+	}
+
+	return res == EEPROM_OK;
+}
+
+bool cfgstore_save_bstate()
+{
+	uint8_t res = write_wl(&bstate_page, (uint8_t*)&g_bstate, sizeof(bstate_t));
+	switch (res)
+	{
+	default:
+		eventlog_write(EVT_ERROR_EEPROM_WRITE);
+		break;
+	case EEPROM_ERROR_ERASE:
+		eventlog_write(EVT_ERROR_EEPROM_ERASE);
+		break;
+	case EEPROM_OK:
+		break;
+	}
+
+	return res == EEPROM_OK;
+}
+
+bool cfgstore_read_stats()
+{
+	uint8_t res = read_wl(&stats_page, (uint8_t*)&g_stats, sizeof(stats_t));
+	if (res != EEPROM_OK)
+	{
+		// version error if no record has been written yet
+		if (res != EEPROM_ERROR_VERSION)
+		{
+			eventlog_write(EVT_ERROR_EEPROM_READ);
+		}
+
+		memset(&g_stats, 0, sizeof(stats_t));
+	}
+
+	return res == EEPROM_OK;
+}
+
+bool cfgstore_save_stats()
+{
+	uint8_t res = write_wl(&stats_page, (uint8_t*)&g_stats, sizeof(stats_t));
+	switch (res)
+	{
+	default:
+		eventlog_write(EVT_ERROR_EEPROM_WRITE);
+		break;
+	case EEPROM_ERROR_ERASE:
+		eventlog_write(EVT_ERROR_EEPROM_ERASE);
+		break;
+	case EEPROM_OK:
+		break;
+	}
+
+	return res == EEPROM_OK;
+}
+
 static bool read_config()
 {
 	eventlog_write(EVT_MSG_CONFIG_READ_BEGIN);
@@ -158,6 +271,15 @@ static void load_default_config()
 	g_config.max_battery_x100v_u16l = (uint8_t)5460;
 	g_config.max_battery_x100v_u16h = (uint8_t)(5460 >> 8);
 	g_config.low_cut_off_v = 42;
+	g_config.battery_capacity_x10ah_u16l = 0;
+	g_config.battery_capacity_x10ah_u16h = 0;
+	g_config.lvc_floor_margin_x10v = 10;
+
+	g_config.boost_current_amps = 0;
+	g_config.boost_duration_s = 10;
+
+	g_config.motor_inductance_uh = 0;
+	g_config.motor_pwm_frequency = PWM_FREQUENCY_15_6KHZ;
 
 	g_config.use_speed_sensor = 1;
 	g_config.use_shift_sensor = HAS_SHIFT_SENSOR_SUPPORT;
@@ -221,6 +343,18 @@ static bool read_pstate()
 	eventlog_write(EVT_MSG_PSTATE_READ_BEGIN);
 
 	uint8_t res = read(EEPROM_PSTATE_PAGE, PSTATE_VERSION, (uint8_t*)&g_pstate, sizeof(pstate_t));
+	if (res == EEPROM_ERROR_VERSION)
+	{
+		// migrate from version 1, keep adc voltage calibration and
+		// use defaults for fields added in later versions
+		load_default_pstate();
+		res = read(EEPROM_PSTATE_PAGE, PSTATE_V1_VERSION, (uint8_t*)&g_pstate, PSTATE_V1_SIZE);
+		if (res == EEPROM_OK && !write_pstate())
+		{
+			res = EEPROM_ERROR_WRITE;
+		}
+	}
+
 	switch (res)
 	{
 	default:
@@ -267,6 +401,18 @@ static void load_default_pstate()
 {
 	g_pstate.adc_voltage_calibration_steps_x100_i16l = 0;
 	g_pstate.adc_voltage_calibration_steps_x100_i16h = 0;
+
+	g_pstate.motor_rotor_calibrated = 0;
+	g_pstate.motor_rotor_offset_angle = 0;
+	memset(g_pstate.motor_hall_angles, 0, sizeof(g_pstate.motor_hall_angles));
+
+	g_pstate.motor_inductance_x1048576 = 0;
+
+	g_pstate.motor_ke_x256_u16l = 0;
+	g_pstate.motor_ke_x256_u16h = 0;
+
+	g_pstate.motor_winding_temperature_c = 0;
+	g_pstate.motor_housing_temperature_c = 0;
 }
 
 static uint8_t read(uint8_t page, uint8_t version, uint8_t* dst, uint8_t size)
@@ -384,3 +530,170 @@ static uint8_t write(uint8_t page, uint8_t version, uint8_t* src, uint8_t size)
 
 	return EEPROM_OK;
 }
+
+/*
+Wear levelled page, records are appended to the page and the newest
+record is found from the sequence number. Page is erased when wrapping
+around (only needed on BBSx where eeprom is emulated in flash).
+*/
+static uint8_t verify_wl_slot(uint8_t offset, uint8_t version, uint8_t size)
+{
+	uint8_t* ptr = (uint8_t*)&wl_header;
+	uint8_t i = 0;
+	int data;
+
+	for (i = 0; i < sizeof(wl_header_t); ++i)
+	{
+		data = eeprom_read_byte(offset);
+		if (data < 0)
+		{
+			return EEPROM_ERROR_READ;
+		}
+		*ptr = (uint8_t)data;
+		++offset;
+		++ptr;
+	}
+
+	if (wl_header.version != version)
+	{
+		return EEPROM_ERROR_VERSION;
+	}
+
+	uint8_t checksum = wl_header.sequence;
+	for (i = 0; i < size; ++i)
+	{
+		data = eeprom_read_byte(offset);
+		if (data < 0)
+		{
+			return EEPROM_ERROR_READ;
+		}
+		checksum += (uint8_t)data;
+		++offset;
+	}
+
+	if (wl_header.checksum != checksum)
+	{
+		return EEPROM_ERROR_CHECKSUM;
+	}
+
+	return EEPROM_OK;
+}
+
+static uint8_t read_wl(wl_page_t* wl, uint8_t* dst, uint8_t size)
+{
+	uint8_t slot_size = sizeof(wl_header_t) + size;
+	uint8_t num_slots = EEPROM_WL_PAGE_SIZE / slot_size;
+	uint8_t newest_slot = 0;
+	bool found = false;
+	uint8_t i = 0;
+	int data;
+
+	wl->next_slot = 0;
+	wl->next_sequence = 0;
+
+	if (!eeprom_select_page(wl->page))
+	{
+		return EEPROM_ERROR_SELECT_PAGE;
+	}
+
+	// records in page span less than half of the sequence range
+	for (i = 0; i < num_slots; ++i)
+	{
+		if (verify_wl_slot(i * slot_size, wl->version, size) == EEPROM_OK &&
+			(!found || (int8_t)(wl_header.sequence - wl->next_sequence) >= 0))
+		{
+			found = true;
+			newest_slot = i;
+			wl->next_sequence = wl_header.sequence + 1;
+		}
+	}
+
+	if (!found)
+	{
+		return EEPROM_ERROR_VERSION;
+	}
+
+	uint8_t read_offset = newest_slot * slot_size + sizeof(wl_header_t);
+	for (i = 0; i < size; ++i)
+	{
+		data = eeprom_read_byte(read_offset);
+		if (data < 0)
+		{
+			return EEPROM_ERROR_READ;
+		}
+		*dst = (uint8_t)data;
+		++read_offset;
+		++dst;
+	}
+
+	wl->next_slot = newest_slot + 1;
+	if (wl->next_slot >= num_slots)
+	{
+		wl->next_slot = 0;
+	}
+
+	return EEPROM_OK;
+}
+
+static uint8_t write_wl(wl_page_t* wl, uint8_t* src, uint8_t size)
+{
+	uint8_t slot_size = sizeof(wl_header_t) + size;
+	uint8_t num_slots = EEPROM_WL_PAGE_SIZE / slot_size;
+	uint8_t write_offset = wl->next_slot * slot_size;
+	uint8_t* ptr = 0;
+	uint8_t i = 0;
+
+	wl_header.version = wl->version;
+	wl_header.sequence = wl->next_sequence;
+	wl_header.checksum = wl->next_sequence;
+
+	if (!eeprom_select_page(wl->page))
+	{
+		return EEPROM_ERROR_SELECT_PAGE;
+	}
+
+	if (wl->next_slot == 0 && !eeprom_erase_page())
+	{
+		return EEPROM_ERROR_ERASE;
+	}
+
+	// data first, header last to invalidate record if interrupted
+	write_offset += sizeof(wl_header_t);
+	for (i = 0; i < size; ++i)
+	{
+		if (!eeprom_write_byte(write_offset, *src))
+		{
+			eeprom_end_write();
+			return EEPROM_ERROR_WRITE;
+		}
+
+		wl_header.checksum += *src;
+		++write_offset;
+		++src;
+	}
+
+	write_offset = wl->next_slot * slot_size;
+	ptr = (uint8_t*)&wl_header;
+	for (i = 0; i < sizeof(wl_header_t); ++i)
+	{
+		if (!eeprom_write_byte(write_offset, *ptr))
+		{
+			eeprom_end_write();
+			return EEPROM_ERROR_WRITE;
+		}
+
+		++write_offset;
+		++ptr;
+	}
+
+	eeprom_end_write();
+
+	++wl->next_sequence;
+	++wl->next_slot;
+	if (wl->next_slot >= num_slots)
+	{
+		wl->next_slot = 0;
+	}
+
+	return EEPROM_OK;
+}
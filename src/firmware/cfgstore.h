@@ -54,8 +54,17 @@
 #define LIGHTS_MODE_ALWAYS_ON			2
 #define LIGHTS_MODE_BRAKE_LIGHT			3
 
-#define CONFIG_VERSION					5
-#define PSTATE_VERSION					1
+#define PWM_FREQUENCY_15_6KHZ			0
+#define PWM_FREQUENCY_19_5KHZ			1
+#define PWM_FREQUENCY_23_4KHZ			2
+
+#define CONFIG_VERSION					6
+#define PSTATE_VERSION					2
+#define BSTATE_VERSION					1
+#define STATS_VERSION					1
+
+// limiter time statistics, indexed by LIMITING_FLAG_* bit (app.h)
+#define STATS_NUM_LIMITERS				5
 
 
 typedef struct
@@ -68,6 +77,9 @@ typedef struct
 
 	// 10 => 1.0: 100w human power gives and additional 100w motor power
 	uint8_t torque_amplification_factor_x10;
+
+	// battery power limit in 10W steps, 0 = no limit
+	uint8_t max_power_w_div10;
 }  assist_level_t;
 
 // SDCC uses little endian for MCS51 and big endian for STM8...
@@ -84,6 +96,23 @@ typedef struct
 	uint8_t low_cut_off_v;
 	uint8_t max_speed_kph;
 
+	// usable battery capacity, 0 = unknown (voltage based SOC)
+	uint8_t battery_capacity_x10ah_u16l;
+	uint8_t battery_capacity_x10ah_u16h;
+
+	// loaded voltage floor above low_cut_off_v, 0 = disabled
+	uint8_t lvc_floor_margin_x10v;
+
+	// boost, peak current for a limited time (I^2t), 0 = disabled
+	uint8_t boost_current_amps;
+	uint8_t boost_duration_s;
+
+	// motor, 0 = identified at runtime (TSDZ2)
+	uint8_t motor_inductance_uh;
+
+	// motor pwm frequency (TSDZ2), PWM_FREQUENCY_*
+	uint8_t motor_pwm_frequency;
+
 	// externals
 	uint8_t use_speed_sensor;
 	uint8_t use_shift_sensor;
@@ -131,11 +160,57 @@ typedef struct
 {
 	uint8_t adc_voltage_calibration_steps_x100_i16l;
 	uint8_t adc_voltage_calibration_steps_x100_i16h;
+
+	// motor rotor calibration (TSDZ2), defaults used if not calibrated
+	uint8_t motor_rotor_calibrated;
+	uint8_t motor_rotor_offset_angle;
+	uint8_t motor_hall_angles[6]; // indexed by hall sensor state - 1
+
+	// identified motor inductance (TSDZ2), 0 if not identified
+	uint8_t motor_inductance_x1048576;
+
+	// identified motor back-emf constant (TSDZ2), 0 if not identified
+	uint8_t motor_ke_x256_u16l;
+	uint8_t motor_ke_x256_u16h;
+
+	// estimated motor temperature (thermal model), 0 if not available
+	uint8_t motor_winding_temperature_c;
+	uint8_t motor_housing_temperature_c;
 } pstate_t;
 
+// Battery state of charge counters, written often and therefore
+// stored as a wear levelled log of records in a separate page.
+typedef struct
+{
+	// used since battery was full
+	uint8_t used_charge_mah_u16l;
+	uint8_t used_charge_mah_u16h;
+	uint8_t used_energy_wh_u16l;
+	uint8_t used_energy_wh_u16h;
+
+	// estimated internal resistance, 0 if not identified
+	uint8_t internal_resistance_mohm_u16l;
+	uint8_t internal_resistance_mohm_u16h;
+} bstate_t;
+
+// Lifetime usage statistics, stored wear levelled in a separate page.
+// Only accessed by firmware, native byte order.
+typedef struct
+{
+	uint32_t odometer_m;
+	uint32_t energy_wh;
+	uint32_t motor_on_s;
+	uint32_t limiting_s[STATS_NUM_LIMITERS];
+	uint16_t peak_current_x10;
+	uint16_t min_voltage_x10;
+	uint8_t peak_temperature_c;
+} stats_t;
+
 
 extern config_t g_config;
 extern pstate_t g_pstate;
+extern bstate_t g_bstate;
+extern stats_t g_stats;
 
 void cfgstore_init();
 
@@ -145,4 +220,10 @@ bool cfgstore_save_config();
 bool cfgstore_reset_pstate();
 bool cfgstore_save_pstate();
 
+bool cfgstore_read_bstate();
+bool cfgstore_save_bstate();
+
+bool cfgstore_read_stats();
+bool cfgstore_save_stats();
+
 #endif
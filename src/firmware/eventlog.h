@@ -24,6 +24,8 @@
 #define EVT_MSG_PSTATE_READ_DONE			8
 #define EVT_MSG_PSTATE_WRITE_BEGIN			9
 #define EVT_MSG_PSTATE_WRITE_DONE			10
+#define EVT_MSG_MOTOR_CALIBRATION_BEGIN		11
+#define EVT_MSG_MOTOR_CALIBRATION_DONE		12
 
 
 #define EVT_ERROR_INIT_MOTOR				64
@@ -43,6 +45,8 @@
 #define EVT_ERROR_WATCHDOG_TRIGGERED		77
 #define EVT_ERROR_EXTCOM_CHEKSUM			78
 #define EVT_ERROR_EXTCOM_DISCARD			79
+#define EVT_ERROR_MOTOR_CALIBRATION			80
+#define EVT_ERROR_MOTOR_PWM_FREQUENCY		81
 
 
 #define EVT_DATA_TARGET_CURRENT				128
@@ -66,6 +70,16 @@
 #define EVT_DATA_CALIBRATE_VOLTAGE			146
 #define EVT_DATA_TORQUE_ADC					147
 #define EVT_DATA_TORQUE_ADC_CALIBRATED		148
+#define EVT_DATA_MOTOR_ROTOR_OFFSET			149
+#define EVT_DATA_MOTOR_INDUCTANCE			150
+#define EVT_DATA_BOOST_BUDGET				151
+#define EVT_DATA_POWER_LIMITING				152
+#define EVT_DATA_BATTERY_RESISTANCE			153
+#define EVT_DATA_LVC_FLOOR_LIMITING			154
+#define EVT_DATA_TASK_OVERRUN				155
+#define EVT_DATA_ASSIST_STAGES				156
+#define EVT_DATA_SVM_TABLE_HIT_RATE			157
+#define EVT_DATA_TASK_MAX_RUNTIME			158
 
 
 void eventlog_init(bool enabled);
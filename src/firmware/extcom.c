@@ -14,6 +14,8 @@
 #include "sensors.h"
 #include "motor.h"
 #include "battery.h"
+#include "range.h"
+#include "stats.h"
 #include "app.h"
 #include "util.h"
 #include "version.h"
@@ -44,10 +46,35 @@
 #define OPCODE_READ_CONFIG						0x03
 #define OPCODE_READ_STATUS						0x04
 
+// read status response data, multi byte values little endian
+// battery voltage x10 (u16), battery current x10 (u16), motor status (u16),
+// battery percent, assist level, target current percent, temperature, boost budget percent,
+// requested current percent (before limiting), limiting flags (stages reducing current)
+#define STATUS_SIZE								13
+
+#define OPCODE_READ_STATS						0x05
+
+// read stats response data, multi byte values little endian
+// odometer m (u32), energy Wh (u32), motor on s (u32),
+// limiting s (u32) speed, thermal, lvc, shift, power,
+// peak current x10 (u16), min voltage x10 (u16), peak temperature
+#define STATS_SIZE								37
+
+#define OPCODE_READ_TRACE						0x06
+
+// read trace response data, variable size
+// requested current percent, current percent after each stage (TRACE_NUM_STAGES),
+// limiting flags, history count, history entries oldest first
+// (requested current percent, target current percent, limiting flags)
+#define TRACE_HEADER_SIZE						(TRACE_NUM_STAGES + 3)
+#define TRACE_HISTORY_ENTRY_SIZE				3
+
 #define OPCODE_WRITE_EVTLOG_ENABLE				0xf0
 #define OPCODE_WRITE_CONFIG						0xf1
 #define OPCODE_WRITE_RESET_CONFIG				0xf2
 #define OPCODE_WRITE_ADC_VOLTAGE_CALIBRATION	0xf3
+#define OPCODE_WRITE_MOTOR_CALIBRATION			0xf4
+#define OPCODE_WRITE_RESET_STATS				0xf5
 
 
 // Bafang display communication
@@ -85,6 +112,7 @@ static uint32_t discard_until_ms;
 
 static uint8_t compute_checksum(uint8_t* buf, uint8_t length);
 static void write_uart_and_increment_checksum(uint8_t data, uint8_t* checksum);
+static void write_uart_u32_and_increment_checksum(uint32_t data, uint8_t* checksum);
 
 static int16_t try_process_request();
 static int16_t try_process_read_request();
@@ -97,11 +125,15 @@ static int16_t process_read_fw_version();
 static int16_t process_read_evtlog_enable();
 static int16_t process_read_config();
 static int16_t process_read_status();
+static int16_t process_read_stats();
+static int16_t process_read_trace();
 
 static int16_t process_write_evtlog_enable();
 static int16_t process_write_config();
 static int16_t process_write_reset_config();
 static int16_t process_write_adc_voltage_calibration();
+static int16_t process_write_motor_calibration();
+static int16_t process_write_reset_stats();
 
 
 static int16_t process_bafang_display_read_status();
@@ -211,6 +243,16 @@ static void write_uart_and_increment_checksum(uint8_t data, uint8_t* checksum)
 	uart_write(data);
 }
 
+static void write_uart_u32_and_increment_checksum(uint32_t data, uint8_t* checksum)
+{
+	uint8_t i;
+	for (i = 0; i < 4; ++i)
+	{
+		write_uart_and_increment_checksum((uint8_t)data, checksum);
+		data >>= 8;
+	}
+}
+
 static int16_t try_process_request()
 {
 	if (msg_len < 1)
@@ -250,6 +292,10 @@ static int16_t try_process_read_request()
 		return process_read_config();
 	case OPCODE_READ_STATUS:
 		return process_read_status();
+	case OPCODE_READ_STATS:
+		return process_read_stats();
+	case OPCODE_READ_TRACE:
+		return process_read_trace();
 	}
 
 	return DISCARD;
@@ -272,6 +318,10 @@ static int16_t try_process_write_request()
 		return process_write_reset_config();
 	case OPCODE_WRITE_ADC_VOLTAGE_CALIBRATION:
 		return process_write_adc_voltage_calibration();
+	case OPCODE_WRITE_MOTOR_CALIBRATION:
+		return process_write_motor_calibration();
+	case OPCODE_WRITE_RESET_STATS:
+		return process_write_reset_stats();
 	}
 
 	return DISCARD;
@@ -419,8 +469,129 @@ static int16_t process_read_config()
 
 static int16_t process_read_status()
 {
-	// :TODO:
-	return 0;
+	if (msg_len < 3)
+	{
+		return KEEP;
+	}
+
+	if (compute_checksum(msgbuf, 2) == msgbuf[2])
+	{
+		uint16_t voltage_x10 = motor_get_battery_voltage_x10();
+		uint16_t current_x10 = motor_get_battery_current_x10();
+		uint16_t status = motor_status();
+
+		uint8_t checksum = 0;
+		write_uart_and_increment_checksum(REQUEST_TYPE_READ, &checksum);
+		write_uart_and_increment_checksum(OPCODE_READ_STATUS, &checksum);
+		write_uart_and_increment_checksum(STATUS_SIZE, &checksum);
+
+		write_uart_and_increment_checksum((uint8_t)voltage_x10, &checksum);
+		write_uart_and_increment_checksum((uint8_t)(voltage_x10 >> 8), &checksum);
+		write_uart_and_increment_checksum((uint8_t)current_x10, &checksum);
+		write_uart_and_increment_checksum((uint8_t)(current_x10 >> 8), &checksum);
+		write_uart_and_increment_checksum((uint8_t)status, &checksum);
+		write_uart_and_increment_checksum((uint8_t)(status >> 8), &checksum);
+		write_uart_and_increment_checksum(battery_get_percent(), &checksum);
+		write_uart_and_increment_checksum(app_get_assist_level(), &checksum);
+		write_uart_and_increment_checksum(motor_get_target_current(), &checksum);
+		write_uart_and_increment_checksum(app_get_temperature(), &checksum);
+		write_uart_and_increment_checksum(app_get_boost_budget_percent(), &checksum);
+		write_uart_and_increment_checksum(app_get_trace()->requested_current, &checksum);
+		write_uart_and_increment_checksum(app_get_trace()->reduced_flags, &checksum);
+
+		uart_write(checksum);
+	}
+	else
+	{
+		eventlog_write(EVT_ERROR_EXTCOM_CHEKSUM);
+		return DISCARD;
+	}
+
+	return 3;
+}
+
+static int16_t process_read_stats()
+{
+	if (msg_len < 3)
+	{
+		return KEEP;
+	}
+
+	if (compute_checksum(msgbuf, 2) == msgbuf[2])
+	{
+		uint8_t i;
+		uint8_t checksum = 0;
+		write_uart_and_increment_checksum(REQUEST_TYPE_READ, &checksum);
+		write_uart_and_increment_checksum(OPCODE_READ_STATS, &checksum);
+		write_uart_and_increment_checksum(STATS_SIZE, &checksum);
+
+		write_uart_u32_and_increment_checksum(g_stats.odometer_m, &checksum);
+		write_uart_u32_and_increment_checksum(g_stats.energy_wh, &checksum);
+		write_uart_u32_and_increment_checksum(g_stats.motor_on_s, &checksum);
+		for (i = 0; i < STATS_NUM_LIMITERS; ++i)
+		{
+			write_uart_u32_and_increment_checksum(g_stats.limiting_s[i], &checksum);
+		}
+		write_uart_and_increment_checksum((uint8_t)g_stats.peak_current_x10, &checksum);
+		write_uart_and_increment_checksum((uint8_t)(g_stats.peak_current_x10 >> 8), &checksum);
+		write_uart_and_increment_checksum((uint8_t)g_stats.min_voltage_x10, &checksum);
+		write_uart_and_increment_checksum((uint8_t)(g_stats.min_voltage_x10 >> 8), &checksum);
+		write_uart_and_increment_checksum(g_stats.peak_temperature_c, &checksum);
+
+		uart_write(checksum);
+	}
+	else
+	{
+		eventlog_write(EVT_ERROR_EXTCOM_CHEKSUM);
+		return DISCARD;
+	}
+
+	return 3;
+}
+
+static int16_t process_read_trace()
+{
+	if (msg_len < 3)
+	{
+		return KEEP;
+	}
+
+	if (compute_checksum(msgbuf, 2) == msgbuf[2])
+	{
+		uint8_t i;
+		const app_trace_t* trace = app_get_trace();
+		uint8_t count = app_get_trace_history_count();
+
+		uint8_t checksum = 0;
+		write_uart_and_increment_checksum(REQUEST_TYPE_READ, &checksum);
+		write_uart_and_increment_checksum(OPCODE_READ_TRACE, &checksum);
+		write_uart_and_increment_checksum(TRACE_HEADER_SIZE + count * TRACE_HISTORY_ENTRY_SIZE, &checksum);
+
+		write_uart_and_increment_checksum(trace->requested_current, &checksum);
+		for (i = 0; i < TRACE_NUM_STAGES; ++i)
+		{
+			write_uart_and_increment_checksum(trace->stage_current[i], &checksum);
+		}
+		write_uart_and_increment_checksum(trace->reduced_flags, &checksum);
+
+		write_uart_and_increment_checksum(count, &checksum);
+		for (i = 0; i < count; ++i)
+		{
+			const app_trace_history_t* entry = app_get_trace_history(i);
+			write_uart_and_increment_checksum(entry->requested_current, &checksum);
+			write_uart_and_increment_checksum(entry->target_current, &checksum);
+			write_uart_and_increment_checksum(entry->reduced_flags, &checksum);
+		}
+
+		uart_write(checksum);
+	}
+	else
+	{
+		eventlog_write(EVT_ERROR_EXTCOM_CHEKSUM);
+		return DISCARD;
+	}
+
+	return 3;
 }
 
 static int16_t process_write_evtlog_enable()
@@ -507,6 +678,32 @@ static int16_t process_write_reset_config()
 		uart_write(checksum);
 	}
 	else
+	{
+		eventlog_write(EVT_ERROR_EXTCOM_CHEKSUM);
+		return DISCARD;
+	}
+
+	return 3;
+}
+
+static int16_t process_write_reset_stats()
+{
+	if (msg_len < 3)
+	{
+		return KEEP;
+	}
+
+	if (compute_checksum(msgbuf, 2) == msgbuf[2])
+	{
+		bool res = stats_reset();
+
+		uint8_t checksum = 0;
+		write_uart_and_increment_checksum(REQUEST_TYPE_WRITE, &checksum);
+		write_uart_and_increment_checksum(OPCODE_WRITE_RESET_STATS, &checksum);
+		write_uart_and_increment_checksum((uint8_t)res, &checksum);
+		uart_write(checksum);
+	}
+	else
 	{
 		eventlog_write(EVT_ERROR_EXTCOM_CHEKSUM);
 		return DISCARD;
@@ -548,6 +745,33 @@ static int16_t process_write_adc_voltage_calibration()
 	return 5;
 }
 
+static int16_t process_write_motor_calibration()
+{
+	if (msg_len < 3)
+	{
+		return KEEP;
+	}
+
+	if (compute_checksum(msgbuf, 2) == msgbuf[2])
+	{
+		// result is reported in eventlog when calibration is completed
+		bool res = motor_start_calibration();
+
+		uint8_t checksum = 0;
+		write_uart_and_increment_checksum(REQUEST_TYPE_WRITE, &checksum);
+		write_uart_and_increment_checksum(OPCODE_WRITE_MOTOR_CALIBRATION, &checksum);
+		write_uart_and_increment_checksum((uint8_t)res, &checksum);
+		uart_write(checksum);
+	}
+	else
+	{
+		eventlog_write(EVT_ERROR_EXTCOM_CHEKSUM);
+		return DISCARD;
+	}
+
+	return 3;
+}
+
 
 static int16_t process_bafang_display_read_status()
 {
@@ -664,35 +888,50 @@ static int16_t process_bafang_display_read_range()
 	}
 
 	uint16_t value = 0;
+	uint8_t field = DISPLAY_RANGE_FIELD_DATA;
 
-#if DISPLAY_RANGE_FIELD_DATA == DISPLAY_RANGE_FIELD_TEMPERATURE
-	value = app_get_temperature();
-	if (g_config.use_freedom_units)
+	if (field == DISPLAY_RANGE_FIELD_RANGE && !range_is_available())
 	{
-		// Convert to farenheit and compensate for the km -> miles conversion the diplay will do
-		// F_miles = (C * 9/5 + 32) * 161 / 100
-		// Approximistation:
-		// F_miles = 2.9C + 50.5
-
-		value = ((290u * value) + 5050u) / 100u;
-	}
-#elif DISPLAY_RANGE_FIELD_DATA == DISPLAY_RANGE_FIELD_POWER
-	if (app_get_lights())
-	{
-		value = motor_get_battery_current_x10();
-	}
-	else
-	{
-		uint16_t max_current_amp_x10 = g_config.max_current_amps * 10;
-		value = MAP32(motor_get_target_current(), 0, 100, 0, max_current_amp_x10);
+		field = DISPLAY_RANGE_FIELD_FALLBACK;
 	}
 
-	if (g_config.use_freedom_units)
+	switch (field)
 	{
-		// compensate for km -> miles conversion the display will do
-		value = (value * 161u) / 100u;
+	case DISPLAY_RANGE_FIELD_TEMPERATURE:
+		value = app_get_temperature();
+		if (g_config.use_freedom_units)
+		{
+			// Convert to farenheit and compensate for the km -> miles conversion the diplay will do
+			// F_miles = (C * 9/5 + 32) * 161 / 100
+			// Approximistation:
+			// F_miles = 2.9C + 50.5
+
+			value = ((290u * value) + 5050u) / 100u;
+		}
+		break;
+	case DISPLAY_RANGE_FIELD_POWER:
+		if (app_get_lights())
+		{
+			value = motor_get_battery_current_x10();
+		}
+		else
+		{
+			// target current percent is relative to boosted max current
+			uint16_t max_current_amp_x10 = app_get_max_current_amps() * 10u;
+			value = MAP32(motor_get_target_current(), 0, 100, 0, max_current_amp_x10);
+		}
+
+		if (g_config.use_freedom_units)
+		{
+			// compensate for km -> miles conversion the display will do
+			value = (value * 161u) / 100u;
+		}
+		break;
+	case DISPLAY_RANGE_FIELD_RANGE:
+		// cached, display converts to miles
+		value = range_get_km();
+		break;
 	}
-#endif
 
 	uint8_t checksum = 0;
 
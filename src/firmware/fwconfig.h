@@ -34,6 +34,14 @@
 	#define HAS_SHIFT_SENSOR_SUPPORT			0
 #endif
 
+// Current ramp up (current_ramp_amps_s) is applied by motor control
+// interrupt instead of in app, throttle override selects a fast ramp.
+#if defined(TSDZ2)
+	#define HAS_MOTOR_CURRENT_RAMP				1
+#else
+	#define HAS_MOTOR_CURRENT_RAMP				0
+#endif
+
 #if defined(BBS02)
 	#define MAX_CADENCE_RPM_X10					1500
 #elif defined(BBSHD)
@@ -55,6 +63,36 @@
 // Current ramp down starts at MAX_TEMPERATURE - 5.
 #define MAX_TEMPERATURE_RAMP_DOWN_INTERVAL		5
 
+// Thermal model used to estimate motor temperature on motors without
+// temperature sensor, see thermal.c. Estimated winding temperature
+// is limited in the same way as a sensor reading (MAX_TEMPERATURE).
+#if defined(TSDZ2)
+	#define THERMAL_MODEL_PHASE_RESISTANCE_MOHM	150
+	#define THERMAL_MODEL_WINDING_CAPACITY_J_K	300
+	#define THERMAL_MODEL_HOUSING_CAPACITY_J_K	1500
+	#define THERMAL_MODEL_WINDING_HOUSING_MK_W	300		// K/W x1000
+	#define THERMAL_MODEL_HOUSING_AMBIENT_MK_W	600		// K/W x1000
+#else
+	#define THERMAL_MODEL_PHASE_RESISTANCE_MOHM	100
+	#define THERMAL_MODEL_WINDING_CAPACITY_J_K	400
+	#define THERMAL_MODEL_HOUSING_CAPACITY_J_K	2500
+	#define THERMAL_MODEL_WINDING_HOUSING_MK_W	250		// K/W x1000
+	#define THERMAL_MODEL_HOUSING_AMBIENT_MK_W	400		// K/W x1000
+#endif
+
+// Assumed ambient temperature in thermal model.
+#define THERMAL_MODEL_AMBIENT_TEMPERATURE		30
+
+// Duty cycle below this is not used to estimate phase current from battery current.
+#define THERMAL_MODEL_MIN_DUTY_PERCENT			20
+
+#define THERMAL_MODEL_INTERVAL_MS				100
+
+// Model state is saved to eeprom when estimated temperature has changed
+// this much, checked at interval.
+#define THERMAL_MODEL_SAVE_DELTA_C				5
+#define THERMAL_MODEL_SAVE_INTERVAL_MS			60000
+
 // Maximum allowed motor current in percent of maximum configured current (A)
 // to still apply when maximum temperature has been reached.
 // Motor current is ramped down linearly until this value when approaching
@@ -77,6 +115,32 @@
 #define BATTERY_FULL_OFFSET_PERCENT		8
 #define BATTERY_EMPTY_OFFSET_PERCENT	8
 
+// Coulomb counting SOC (battery capacity configured), counted SOC is
+// replaced by voltage SOC at startup if they differ more than this (e.g. charged).
+#define BATTERY_SOC_RESYNC_PERCENT		20
+// Counted charge is corrected with 1/N of the difference to voltage SOC
+// once for every no load period.
+#define BATTERY_SOC_ANCHOR_FILTER		4
+// Counters are saved when changed this much and motor is idle.
+#define BATTERY_SOC_SAVE_DELTA_MAH		100
+
+// Battery internal resistance is estimated from voltage and current changes
+// during load steps larger than this, sampled every 100ms. Estimates outside
+// min/max are discarded (measurement not settled).
+#define BATTERY_RESISTANCE_MIN_STEP_X10	30
+#define BATTERY_RESISTANCE_MIN_MOHM		20
+#define BATTERY_RESISTANCE_MAX_MOHM		300
+#define BATTERY_RESISTANCE_FILTER		8
+// Estimate is logged and saved when changed this much.
+#define BATTERY_RESISTANCE_SAVE_DELTA_MOHM	20
+// Max voltage added for I*R when estimating open circuit voltage.
+#define BATTERY_RESISTANCE_MAX_COMPENSATION_X100V	300
+
+// Predictive LVC (lvc_floor_margin_x10v), current is limited to keep loaded
+// voltage above floor using estimated battery resistance. Limit is
+// decreased immediately and increased with this filter every 50ms.
+#define LVC_FLOOR_RAMP_UP_FILTER		8
+
 // Battery SOC percentage when current ramp down starts.
 #define LVC_RAMP_DOWN_OFFSET_PERCENT			10
 
@@ -91,6 +155,18 @@
 // and be at 50% of assist target current when reaching 50.
 #define SPEED_LIMIT_RAMP_DOWN_INTERVAL_KPH		3
 
+// Boost current (boost_current_amps) is available until the remaining
+// I^2t budget reaches this percent, then ramped down linearly to
+// max current when budget approaches zero.
+#define BOOST_BUDGET_RAMP_DOWN_PERCENT			25
+
+// Battery power limiter (assist level max power), PI controller
+// trimming target current. Output is percent x256, error in watts,
+// gains are x256 and the integral term is updated every interval.
+#define POWER_LIMIT_INTERVAL_MS					20
+#define POWER_LIMIT_KP_X256						6
+#define POWER_LIMIT_KI_X256						2
+
 // Current ramp down (e.g. when releasing throttle, stop pedaling etc.) in percent per 10 millisecond.
 // Specifying 1 will make ramp down periond 1 second if releasing from full throttle.
 // Set to 100 to disable
@@ -151,22 +227,51 @@
 #define CRUISE_DISENGAGE_PAS_PULSES				PAS_PULSES_REVOLUTION / 2
 
 
-// Option to control what data is displayed in "Range" field on display
-// since range calculation is not implemented.
+// Option to control what data is displayed in "Range" field on display.
 #define DISPLAY_RANGE_FIELD_ZERO				0
 #define DISPLAY_RANGE_FIELD_TEMPERATURE			1	// max temperature of controller / motor
 #define DISPLAY_RANGE_FIELD_POWER				2	// requested current x10 (lights off) / actual current x10 (lights on)
+#define DISPLAY_RANGE_FIELD_RANGE				3	// estimated remaining range (km), requires battery capacity configured
 
 // uncomment and select option above
 // #define DISPLAY_RANGE_FIELD_DATA		DISPLAY_RANGE_FIELD_ZERO
 
-// default to temperature if temperature sensors available (BBS2/BBSHD), else power (TSDZ2)
 #ifndef DISPLAY_RANGE_FIELD_DATA
+	#define DISPLAY_RANGE_FIELD_DATA		DISPLAY_RANGE_FIELD_RANGE
+#endif
+
+// Data displayed until range estimate is available, defaults to temperature
+// if temperature sensors available (BBS2/BBSHD), else power (TSDZ2)
+#ifndef DISPLAY_RANGE_FIELD_FALLBACK
 	#if HAS_CONTROLLER_TEMP_SENSOR || HAS_MOTOR_TEMP_SENSOR
-	#define DISPLAY_RANGE_FIELD_DATA		DISPLAY_RANGE_FIELD_TEMPERATURE
+	#define DISPLAY_RANGE_FIELD_FALLBACK	DISPLAY_RANGE_FIELD_TEMPERATURE
 	#else
-	#define DISPLAY_RANGE_FIELD_DATA		DISPLAY_RANGE_FIELD_POWER
+	#define DISPLAY_RANGE_FIELD_FALLBACK	DISPLAY_RANGE_FIELD_POWER
 	#endif
-#endif 
+#endif
+
+// Assist pipeline current trace history, one entry per interval
+// with stage reductions within the interval combined.
+#define TRACE_HISTORY_SIZE						16
+#define TRACE_HISTORY_INTERVAL_MS				200
+
+// Worst main loop pass interval is reported to eventlog this often.
+#define SCHEDULER_REPORT_INTERVAL_MS			10000
+
+// Assist is recalculated immediately on PAS pulse, brake edge or throttle
+// step in between regular runs, such extra runs are made at most this often.
+#define SCHEDULER_EVENT_MIN_INTERVAL_MS			10
+
+// Throttle adc change since last assist calculation which triggers recalculation.
+#define THROTTLE_STEP_EVENT_ADC					5
+
+// Usage statistics are saved at most this often (when changed and motor idle).
+#define STATS_SAVE_INTERVAL_MS					300000
+// Usage statistics are also saved once when motor has been idle this long.
+#define STATS_IDLE_SAVE_DELAY_MS				5000
+
+// Range estimate, consumption is averaged over segments of this distance.
+#define RANGE_SEGMENT_M							500
+#define RANGE_CONSUMPTION_FILTER				8
 
 #endif
@@ -14,6 +14,11 @@
 #include "eventlog.h"
 #include "app.h"
 #include "battery.h"
+#include "usage.h"
+#include "thermal.h"
+#include "range.h"
+#include "stats.h"
+#include "scheduler.h"
 #include "watchdog.h"
 #include "adc.h"
 #include "motor.h"
@@ -26,6 +31,21 @@
 
 #define APP_PROCESS_INTERVAL_MS		5
 
+// Ordered by priority, highest first.
+static task_t tasks[] =
+{
+	{ adc_process, SCHEDULER_EVERY_PASS },
+	{ motor_process, SCHEDULER_EVERY_PASS },
+	{ sensors_process, APP_PROCESS_INTERVAL_MS },
+	{ app_process, APP_PROCESS_INTERVAL_MS, app_event_pending },
+	{ extcom_process, APP_PROCESS_INTERVAL_MS },
+	{ usage_process, APP_PROCESS_INTERVAL_MS },
+	{ battery_process, APP_PROCESS_INTERVAL_MS },
+	{ thermal_process, APP_PROCESS_INTERVAL_MS },
+	{ range_process, APP_PROCESS_INTERVAL_MS },
+	{ stats_process, APP_PROCESS_INTERVAL_MS }
+};
+
 void main(void)
 {
 	motor_pre_init();
@@ -55,37 +75,27 @@ void main(void)
 	speed_sensor_set_signals_per_rpm(g_config.speed_sensor_signals);
 	pas_set_stop_delay((uint16_t)g_config.pas_stop_delay_x100s * 10);
 
+	usage_init();
 	battery_init();
+	thermal_init();
+	range_init();
+	stats_init();
 	throttle_init(
 		EXPAND_U16(g_config.throttle_start_voltage_mv_u16h, g_config.throttle_start_voltage_mv_u16l),
 		EXPAND_U16(g_config.throttle_end_voltage_mv_u16h, g_config.throttle_end_voltage_mv_u16l)
 	);
 
-	motor_init(g_config.max_current_amps * 1000, g_config.low_cut_off_v,
+	motor_init(app_get_max_current_amps() * 1000, g_config.low_cut_off_v,
 		EXPAND_I16(g_pstate.adc_voltage_calibration_steps_x100_i16h, g_pstate.adc_voltage_calibration_steps_x100_i16l));
 
 	lights_init();
 
 	app_init();
 
-	uint32_t next_app_proccess = system_ms();
+	scheduler_init(tasks, sizeof(tasks) / sizeof(task_t));
 	while (1)
 	{
-		uint32_t now = system_ms();
-	
-		adc_process();
-		motor_process();
-
-		if (now >= next_app_proccess)
-		{
-			next_app_proccess = now + APP_PROCESS_INTERVAL_MS;
-
-			battery_process();
-			sensors_process();
-			extcom_process();
-			app_process();
-		}
-
+		scheduler_run();
 		watchdog_yeild();
 	}
 }
@@ -10,6 +10,7 @@
 #define _MOTOR_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define MOTOR_ERROR_LVC				0x0800
 #define MOTOR_ERROR_HALL_SENSOR		0x2000
@@ -30,11 +31,14 @@ uint8_t motor_get_target_current();
 
 void motor_set_target_speed(uint8_t percent);
 void motor_set_target_current(uint8_t percent);
+void motor_set_fast_current_ramp(bool enable);
 
 int16_t motor_calibrate_battery_voltage(uint16_t actual_voltage_x100);
+bool motor_start_calibration();
 
 uint16_t motor_get_battery_lvc_x10();
 uint16_t motor_get_battery_current_x10();
 uint16_t motor_get_battery_voltage_x10();
+uint8_t motor_get_duty_cycle_percent();
 
 #endif
@@ -0,0 +1,117 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include "range.h"
+#include "battery.h"
+#include "usage.h"
+#include "system.h"
+#include "cfgstore.h"
+#include "fwconfig.h"
+#include "util.h"
+
+/*
+Remaining range estimate from remaining battery energy and average consumption.
+
+Distance and energy are read from the usage counters (usage.c) every 100ms.
+Consumption is computed for every RANGE_SEGMENT_M of distance and averaged
+with an exponential filter (RANGE_CONSUMPTION_FILTER) over segments.
+
+Consumption is kept in mJ/m (1 Wh/km = 3.6 J/m = 3600 mJ/m), remaining range in km is then:
+	range_km = remaining_wh * 3600 / consumption_mj_per_m
+*/
+
+static uint32_t last_distance_mm;
+static uint32_t last_energy_mj;
+static uint32_t segment_distance_mm;
+static uint32_t segment_energy_mj;
+static uint32_t consumption_mj_per_m;
+static uint16_t range_km;
+static uint32_t next_update_ms;
+static uint8_t update_counter;
+
+static void update_range()
+{
+	uint16_t remaining_wh = battery_get_remaining_wh();
+
+	if (consumption_mj_per_m > 0)
+	{
+		uint32_t km = (remaining_wh * 3600ul) / consumption_mj_per_m;
+		range_km = km > 999 ? 999 : (uint16_t)km;
+	}
+}
+
+void range_init()
+{
+	last_distance_mm = usage_get_distance_mm();
+	last_energy_mj = usage_get_energy_mj();
+	segment_distance_mm = 0;
+	segment_energy_mj = 0;
+	consumption_mj_per_m = 0;
+	range_km = 0;
+	next_update_ms = 0;
+	update_counter = 0;
+}
+
+void range_process()
+{
+	if (system_ms() < next_update_ms)
+	{
+		return;
+	}
+
+	next_update_ms = system_ms() + 100;
+
+	uint32_t distance_mm = usage_get_distance_mm();
+	uint32_t energy_mj = usage_get_energy_mj();
+
+	segment_distance_mm += distance_mm - last_distance_mm;
+	segment_energy_mj += energy_mj - last_energy_mj;
+	last_distance_mm = distance_mm;
+	last_energy_mj = energy_mj;
+
+	if (segment_distance_mm >= RANGE_SEGMENT_M * 1000ul)
+	{
+		uint32_t segment_mj_per_m = segment_energy_mj / (segment_distance_mm / 1000);
+
+		if (consumption_mj_per_m == 0)
+		{
+			consumption_mj_per_m = segment_mj_per_m;
+		}
+		else
+		{
+			consumption_mj_per_m = EXPONENTIAL_FILTER((int32_t)consumption_mj_per_m, (int32_t)segment_mj_per_m, RANGE_CONSUMPTION_FILTER);
+		}
+
+		// avoid division by zero
+		if (consumption_mj_per_m == 0)
+		{
+			consumption_mj_per_m = 1;
+		}
+
+		segment_distance_mm = 0;
+		segment_energy_mj = 0;
+	}
+
+	// remaining energy changes slowly, update cached value every second
+	if (++update_counter >= 10)
+	{
+		update_counter = 0;
+		update_range();
+	}
+}
+
+bool range_is_available()
+{
+	return consumption_mj_per_m > 0 &&
+		EXPAND_U16(g_config.battery_capacity_x10ah_u16h, g_config.battery_capacity_x10ah_u16l) > 0;
+}
+
+uint16_t range_get_km()
+{
+	return range_km;
+}
@@ -0,0 +1,23 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _RANGE_H_
+#define _RANGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void range_init();
+void range_process();
+
+// Estimate is available when battery capacity is configured
+// and enough distance has been ridden to know consumption.
+bool range_is_available();
+uint16_t range_get_km();
+
+#endif
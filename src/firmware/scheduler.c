@@ -0,0 +1,182 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include "scheduler.h"
+#include "system.h"
+#include "eventlog.h"
+#include "fwconfig.h"
+
+#include <stddef.h>
+
+/*
+Cooperative fixed period scheduler.
+
+Tasks with period SCHEDULER_EVERY_PASS run on every pass of the main loop.
+Of the periodic tasks only the highest priority task which is due runs on
+each pass, keeping the time between every pass tasks short.
+
+Periodic tasks are scheduled at a fixed rate, a task which is started a
+full period or more after it was due has overrun and is rescheduled
+relative to now instead of trying to catch up.
+
+A periodic task with an event function is also run as soon as the event
+function reports a pending event. Such extra runs are limited to one every
+SCHEDULER_EVENT_MIN_INTERVAL_MS, independent of the periodic runs, and not in
+the same millisecond as the previous run. The periodic schedule restarts from
+that run and acts as fallback.
+
+Runtime is measured with system_ms() so only tasks running for a
+millisecond or more are visible, e.g. an eeprom erase.
+
+Overruns and the slowest task are reported to the event log once every
+SCHEDULER_REPORT_INTERVAL_MS, coalesced per task, and then reset.
+*/
+
+static task_t* task_table;
+static uint8_t task_count;
+
+static uint32_t last_pass_ms;
+static uint8_t max_pass_interval_ms;
+static uint32_t next_report_ms;
+
+static void run_task(task_t* task)
+{
+	uint32_t start = system_ms();
+	task->last_ms = start;
+	task->process();
+	uint32_t runtime = system_ms() - start;
+
+	if (runtime > task->max_runtime_ms)
+	{
+		task->max_runtime_ms = runtime > 255 ? 255 : (uint8_t)runtime;
+	}
+}
+
+static void report_tasks()
+{
+	uint8_t i;
+	uint8_t slowest = 0;
+
+	for (i = 0; i < task_count; ++i)
+	{
+		task_t* task = &task_table[i];
+
+		if (task->overruns > 0)
+		{
+			eventlog_write_data(EVT_DATA_TASK_OVERRUN, ((uint16_t)i << 8) | task->overruns);
+			task->overruns = 0;
+		}
+
+		if (task->max_runtime_ms > task_table[slowest].max_runtime_ms)
+		{
+			slowest = i;
+		}
+	}
+
+	if (task_table[slowest].max_runtime_ms > 0)
+	{
+		eventlog_write_data(EVT_DATA_TASK_MAX_RUNTIME, ((uint16_t)slowest << 8) | task_table[slowest].max_runtime_ms);
+	}
+
+	for (i = 0; i < task_count; ++i)
+	{
+		task_table[i].max_runtime_ms = 0;
+	}
+}
+
+static void update_pass_interval(uint32_t now)
+{
+	uint32_t interval = now - last_pass_ms;
+	last_pass_ms = now;
+
+	if (interval > max_pass_interval_ms)
+	{
+		max_pass_interval_ms = interval > 255 ? 255 : (uint8_t)interval;
+	}
+
+	if (now >= next_report_ms)
+	{
+		next_report_ms = now + SCHEDULER_REPORT_INTERVAL_MS;
+		eventlog_write_data(EVT_DATA_MAIN_LOOP_TIME, max_pass_interval_ms);
+		max_pass_interval_ms = 0;
+
+		report_tasks();
+	}
+}
+
+void scheduler_init(task_t* tasks, uint8_t num_tasks)
+{
+	uint8_t i;
+	uint32_t now = system_ms();
+
+	task_table = tasks;
+	task_count = num_tasks;
+
+	for (i = 0; i < task_count; ++i)
+	{
+		task_table[i].next_ms = now;
+		task_table[i].last_ms = now;
+		task_table[i].last_event_ms = now;
+		task_table[i].max_runtime_ms = 0;
+		task_table[i].overruns = 0;
+	}
+
+	last_pass_ms = now;
+	max_pass_interval_ms = 0;
+	next_report_ms = now + SCHEDULER_REPORT_INTERVAL_MS;
+}
+
+void scheduler_run()
+{
+	uint8_t i;
+	bool periodic_run = false;
+	uint32_t now = system_ms();
+
+	update_pass_interval(now);
+
+	for (i = 0; i < task_count; ++i)
+	{
+		task_t* task = &task_table[i];
+
+		if (task->period_ms == SCHEDULER_EVERY_PASS)
+		{
+			run_task(task);
+		}
+		else if (!periodic_run && now >= task->next_ms)
+		{
+			periodic_run = true;
+
+			task->next_ms += task->period_ms;
+			if (task->next_ms <= now)
+			{
+				task->next_ms = now + task->period_ms;
+				if (task->overruns < 255)
+				{
+					++task->overruns;
+				}
+			}
+
+			// consume pending event, handled by this run
+			if (task->event != NULL)
+			{
+				task->event();
+			}
+
+			run_task(task);
+		}
+		else if (!periodic_run && task->event != NULL && now != task->last_ms &&
+			(now - task->last_event_ms) >= SCHEDULER_EVENT_MIN_INTERVAL_MS && task->event())
+		{
+			periodic_run = true;
+			task->next_ms = now + task->period_ms;
+			task->last_event_ms = now;
+
+			run_task(task);
+		}
+	}
+}
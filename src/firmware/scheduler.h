@@ -0,0 +1,37 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHEDULER_EVERY_PASS	0
+
+typedef struct
+{
+	void (*process)();
+	uint8_t period_ms;
+
+	// optional, periodic task runs immediately when returning true
+	bool (*event)();
+
+	// managed by scheduler
+	uint32_t next_ms;
+	uint32_t last_ms;
+	uint32_t last_event_ms;
+	uint8_t max_runtime_ms;
+	uint8_t overruns;
+} task_t;
+
+// Task table is ordered by priority, highest first.
+void scheduler_init(task_t* tasks, uint8_t num_tasks);
+void scheduler_run();
+
+#endif
@@ -14,9 +14,35 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Consistent view of sensor state, captured once per control cycle.
+typedef struct
+{
+	uint32_t ms;
+
+	uint16_t pas_cadence_rpm_x10;
+	uint16_t pas_pulse_counter;
+	bool pas_pedaling_forwards;
+	bool pas_pedaling_backwards;
+
+	uint16_t speed_rpm_x10;
+	uint16_t speed_pulse_counter;
+	bool speed_moving;
+
+	uint16_t torque_nm_x100;
+
+	bool brake;
+	bool shift_sensor;
+} sensors_snapshot_t;
+
 void sensors_init();
 void sensors_process();
 
+// ISR shared values are read in a single critical section
+void sensors_snapshot(sensors_snapshot_t* snapshot);
+
+// PAS pulse or brake edge since last call
+bool sensors_event_pending();
+
 void pas_set_stop_delay(uint16_t delay_ms);
 uint16_t pas_get_cadence_rpm_x10();
 uint16_t pas_get_pulse_counter();
@@ -26,6 +52,7 @@ bool pas_is_pedaling_backwards();
 void speed_sensor_set_signals_per_rpm(uint8_t num_signals);
 bool speed_sensor_is_moving();
 uint16_t speed_sensor_get_rpm_x10();
+uint16_t speed_sensor_get_pulse_counter();
 
 uint16_t torque_sensor_get_nm_x100();
 bool torque_sensor_ok();
@@ -0,0 +1,162 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include "stats.h"
+#include "app.h"
+#include "motor.h"
+#include "usage.h"
+#include "system.h"
+#include "cfgstore.h"
+#include "fwconfig.h"
+#include "util.h"
+
+#include <string.h>
+
+/*
+Lifetime usage statistics, accumulated every 100ms into g_stats.
+Distance and energy are read from the usage counters (usage.c).
+
+Sub unit remainders are kept in RAM and statistics are saved to eeprom
+(wear levelled) at most every STATS_SAVE_INTERVAL_MS and only when the
+motor is idle, coalescing all changes since last save into one write.
+Statistics are also saved once when the motor has been idle for
+STATS_IDLE_SAVE_DELAY_MS, so a ride is stored soon after stopping while
+short stops do not cause extra writes.
+*/
+
+static uint32_t last_distance_mm;
+static uint32_t last_energy_mj;
+static uint32_t distance_mm;
+static uint32_t energy_mj;
+static uint16_t motor_on_ms;
+static uint16_t limiting_ms[STATS_NUM_LIMITERS];
+static bool dirty;
+static uint32_t next_update_ms;
+static uint32_t next_save_ms;
+static uint32_t idle_save_ms;
+
+static void update()
+{
+	uint16_t voltage_x10 = motor_get_battery_voltage_x10();
+	uint16_t current_x10 = motor_get_battery_current_x10();
+	uint8_t temperature = app_get_temperature();
+	uint8_t limiting = app_get_limiting_flags();
+	uint8_t i;
+
+	uint32_t usage_distance_mm = usage_get_distance_mm();
+	distance_mm += usage_distance_mm - last_distance_mm;
+	last_distance_mm = usage_distance_mm;
+	if (distance_mm >= 1000)
+	{
+		g_stats.odometer_m += distance_mm / 1000;
+		distance_mm %= 1000;
+		dirty = true;
+	}
+
+	// 1Wh = 3600000mJ
+	uint32_t usage_energy_mj = usage_get_energy_mj();
+	energy_mj += usage_energy_mj - last_energy_mj;
+	last_energy_mj = usage_energy_mj;
+	if (energy_mj >= 3600000ul)
+	{
+		g_stats.energy_wh += energy_mj / 3600000ul;
+		energy_mj %= 3600000ul;
+		dirty = true;
+	}
+
+	if (motor_get_target_current() > 0)
+	{
+		motor_on_ms += 100;
+		if (motor_on_ms >= 1000)
+		{
+			++g_stats.motor_on_s;
+			motor_on_ms -= 1000;
+			dirty = true;
+		}
+	}
+
+	for (i = 0; i < STATS_NUM_LIMITERS; ++i)
+	{
+		if (limiting & (1 << i))
+		{
+			limiting_ms[i] += 100;
+			if (limiting_ms[i] >= 1000)
+			{
+				++g_stats.limiting_s[i];
+				limiting_ms[i] -= 1000;
+				dirty = true;
+			}
+		}
+	}
+
+	if (current_x10 > g_stats.peak_current_x10)
+	{
+		g_stats.peak_current_x10 = current_x10;
+		dirty = true;
+	}
+
+	if (temperature > g_stats.peak_temperature_c)
+	{
+		g_stats.peak_temperature_c = temperature;
+		dirty = true;
+	}
+
+	if (voltage_x10 > 0 && (g_stats.min_voltage_x10 == 0 || voltage_x10 < g_stats.min_voltage_x10))
+	{
+		g_stats.min_voltage_x10 = voltage_x10;
+		dirty = true;
+	}
+}
+
+void stats_init()
+{
+	last_distance_mm = usage_get_distance_mm();
+	last_energy_mj = usage_get_energy_mj();
+	distance_mm = 0;
+	energy_mj = 0;
+	motor_on_ms = 0;
+	memset(limiting_ms, 0, sizeof(limiting_ms));
+	dirty = false;
+	next_update_ms = 0;
+	next_save_ms = STATS_SAVE_INTERVAL_MS;
+	idle_save_ms = 0;
+
+	cfgstore_read_stats();
+}
+
+void stats_process()
+{
+	uint32_t now = system_ms();
+
+	if (now >= next_update_ms)
+	{
+		next_update_ms = now + 100;
+		update();
+	}
+
+	if (motor_get_target_current() > 0)
+	{
+		// restarted on every pass until motor stops, 0 when no save pending
+		idle_save_ms = now + STATS_IDLE_SAVE_DELAY_MS;
+	}
+	else if (dirty && (now >= next_save_ms || (idle_save_ms != 0 && now >= idle_save_ms)))
+	{
+		next_save_ms = now + STATS_SAVE_INTERVAL_MS;
+		idle_save_ms = 0;
+		dirty = false;
+		cfgstore_save_stats();
+	}
+}
+
+bool stats_reset()
+{
+	memset(&g_stats, 0, sizeof(stats_t));
+	dirty = false;
+
+	return cfgstore_save_stats();
+}
@@ -0,0 +1,20 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void stats_init();
+void stats_process();
+
+bool stats_reset();
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include "thermal.h"
+#include "motor.h"
+#include "sensors.h"
+#include "system.h"
+#include "cfgstore.h"
+#include "fwconfig.h"
+#include "util.h"
+
+/*
+Sensorless motor temperature estimate for motors without temperature sensor.
+
+Two node lumped model, motor winding and motor housing:
+
+	C_winding * dT_winding / dt = P - (T_winding - T_housing) / R_winding_housing
+	C_housing * dT_housing / dt = (T_winding - T_housing) / R_winding_housing - (T_housing - T_ambient) / R_housing_ambient
+
+Heat source P is copper loss I^2 * R where phase current is estimated from
+battery current and duty cycle (I_phase = I_battery / duty). On BBSHD/BBS02
+duty cycle is estimated from crank cadence, see bbsx/motor.c, and falls back
+to THERMAL_MODEL_MIN_DUTY_PERCENT when not pedaling (throttle only), which
+overestimates loss rather than underestimating it.
+
+Ambient temperature is THERMAL_MODEL_AMBIENT_TEMPERATURE, or controller
+temperature if higher and sensor is available (BBS02).
+
+Temperatures are kept in micro degrees celsius, with power in mW, time in ms
+and heat capacity in J/K the temperature change is in micro degrees without scaling.
+
+Model state is saved to pstate when the estimate has changed by THERMAL_MODEL_SAVE_DELTA_C,
+at most every THERMAL_MODEL_SAVE_INTERVAL_MS and only when the motor is idle (eeprom
+writes erase a full flash page on BBS02), and is restored at startup. The time the controller was powered off is unknown, no
+cooling is assumed (conservative).
+*/
+
+#if !HAS_MOTOR_TEMP_SENSOR
+
+static int32_t winding_uc;
+static int32_t housing_uc;
+static uint32_t next_update_ms;
+static uint32_t next_save_ms;
+
+static int32_t get_ambient_uc()
+{
+	int32_t ambient_uc = THERMAL_MODEL_AMBIENT_TEMPERATURE * 1000000l;
+
+#if HAS_CONTROLLER_TEMP_SENSOR
+	int32_t contr_uc = temperature_contr_x100() * 10000l;
+	if (contr_uc > ambient_uc)
+	{
+		ambient_uc = contr_uc;
+	}
+#endif
+
+	return ambient_uc;
+}
+
+static int32_t restore_temperature_uc(uint8_t saved_c)
+{
+	int32_t value_uc = saved_c * 1000000l;
+	int32_t ambient_uc = THERMAL_MODEL_AMBIENT_TEMPERATURE * 1000000l;
+
+	return value_uc > ambient_uc ? value_uc : ambient_uc;
+}
+
+static uint8_t to_saved_temperature_c(int32_t value_uc)
+{
+	int32_t value_c = value_uc / 1000000l;
+	return (uint8_t)CLAMP(value_c, 0, 255);
+}
+
+static void save_state()
+{
+	uint8_t winding_c = to_saved_temperature_c(winding_uc);
+	int16_t diff_c = (int16_t)winding_c - g_pstate.motor_winding_temperature_c;
+
+	if (diff_c >= THERMAL_MODEL_SAVE_DELTA_C || diff_c <= -THERMAL_MODEL_SAVE_DELTA_C)
+	{
+		g_pstate.motor_winding_temperature_c = winding_c;
+		g_pstate.motor_housing_temperature_c = to_saved_temperature_c(housing_uc);
+		cfgstore_save_pstate();
+	}
+}
+
+#endif
+
+
+void thermal_init()
+{
+#if !HAS_MOTOR_TEMP_SENSOR
+	winding_uc = restore_temperature_uc(g_pstate.motor_winding_temperature_c);
+	housing_uc = restore_temperature_uc(g_pstate.motor_housing_temperature_c);
+
+	next_update_ms = 0;
+	next_save_ms = THERMAL_MODEL_SAVE_INTERVAL_MS;
+#endif
+}
+
+void thermal_process()
+{
+#if !HAS_MOTOR_TEMP_SENSOR
+	uint32_t now = system_ms();
+	if (now < next_update_ms)
+	{
+		return;
+	}
+
+	next_update_ms = now + THERMAL_MODEL_INTERVAL_MS;
+
+	uint8_t duty_percent = motor_get_duty_cycle_percent();
+	if (duty_percent < THERMAL_MODEL_MIN_DUTY_PERCENT)
+	{
+		duty_percent = THERMAL_MODEL_MIN_DUTY_PERCENT;
+	}
+
+	uint32_t phase_current_x10 = ((uint32_t)motor_get_battery_current_x10() * 100) / duty_percent;
+	int32_t loss_mw = (int32_t)((phase_current_x10 * phase_current_x10 * THERMAL_MODEL_PHASE_RESISTANCE_MOHM) / 100);
+
+	// heat flow in mW, thermal resistance in K/W x1000
+	int32_t winding_housing_mw = (winding_uc - housing_uc) / THERMAL_MODEL_WINDING_HOUSING_MK_W;
+	int32_t housing_ambient_mw = (housing_uc - get_ambient_uc()) / THERMAL_MODEL_HOUSING_AMBIENT_MK_W;
+
+	winding_uc += ((loss_mw - winding_housing_mw) * THERMAL_MODEL_INTERVAL_MS) / THERMAL_MODEL_WINDING_CAPACITY_J_K;
+	housing_uc += ((winding_housing_mw - housing_ambient_mw) * THERMAL_MODEL_INTERVAL_MS) / THERMAL_MODEL_HOUSING_CAPACITY_J_K;
+
+	if (now >= next_save_ms && motor_get_target_current() == 0)
+	{
+		next_save_ms = now + THERMAL_MODEL_SAVE_INTERVAL_MS;
+		save_state();
+	}
+#endif
+}
+
+int16_t thermal_get_motor_temperature_x100()
+{
+#if !HAS_MOTOR_TEMP_SENSOR
+	return (int16_t)(winding_uc / 10000l);
+#else
+	return 0;
+#endif
+}
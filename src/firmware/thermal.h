@@ -0,0 +1,21 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _THERMAL_H_
+#define _THERMAL_H_
+
+#include <stdint.h>
+
+void thermal_init();
+void thermal_process();
+
+// Estimated motor winding temperature, used instead of sensor
+// on motors without temperature sensor (HAS_MOTOR_TEMP_SENSOR).
+int16_t thermal_get_motor_temperature_x100();
+
+#endif
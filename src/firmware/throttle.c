@@ -23,6 +23,8 @@ static bool throttle_detected;
 static bool throttle_low_ok;
 static bool throttle_hard_ok;
 static uint32_t throttle_hard_limit_hit_at;
+static uint8_t last_read_adc;
+static uint8_t last_step_adc;
 
 
 //#define LOG_THROTTLE_ADC
@@ -53,6 +55,8 @@ void throttle_init(uint16_t min_mv, uint16_t max_mv)
 	throttle_low_ok = false;
 	throttle_hard_ok = true;
 	throttle_hard_limit_hit_at = 0;
+	last_read_adc = 0;
+	last_step_adc = 0;
 }
 
 bool throttle_ok()
@@ -65,6 +69,7 @@ uint8_t throttle_read()
 	static uint8_t throttle_percent = 0;
 
 	int16_t value = adc_get_throttle();
+	last_read_adc = (uint8_t)value;
 
 #ifdef LOG_THROTTLE_ADC
 	static uint8_t last_logged_throttle_adc = 0;	
@@ -139,6 +144,31 @@ uint8_t throttle_read()
 	return throttle_percent;
 }
 
+static bool is_step(uint8_t value, uint8_t reference)
+{
+	if (value > reference)
+	{
+		return (value - reference) >= THROTTLE_STEP_EVENT_ADC;
+	}
+
+	return (reference - value) >= THROTTLE_STEP_EVENT_ADC;
+}
+
+bool throttle_step_detected()
+{
+	uint8_t value = adc_get_throttle();
+
+	// hysteresis, must also have moved from value which triggered
+	// last event, noise between reads does not trigger events
+	if (is_step(value, last_read_adc) && is_step(value, last_step_adc))
+	{
+		last_step_adc = value;
+		return true;
+	}
+
+	return false;
+}
+
 
 uint8_t throttle_map_response(uint8_t throttle_percent)
 {
@@ -18,6 +18,9 @@ void throttle_init(uint16_t min_mv, uint16_t max_mv);
 bool throttle_ok();
 uint8_t throttle_read();
 
+// throttle input changed since last throttle_read
+bool throttle_step_detected();
+
 uint8_t throttle_map_response(uint8_t throttle_percent);
 
 #endif
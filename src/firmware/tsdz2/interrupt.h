@@ -13,6 +13,9 @@
 #include "tsdz2/stm8s/stm8s_itc.h"
 
 void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM); // motor.c
+void isr_exti_portc(void) __interrupt(ITC_IRQ_PORTC);		// motor.c
+void isr_exti_portd(void) __interrupt(ITC_IRQ_PORTD);		// motor.c
+void isr_exti_porte(void) __interrupt(ITC_IRQ_PORTE);		// motor.c
 void isr_timer3_ovf(void) __interrupt(ITC_IRQ_TIM3_OVF);	// system.c
 void isr_timer4_ovf(void) __interrupt(ITC_IRQ_TIM4_OVF);	// sensors.c
 
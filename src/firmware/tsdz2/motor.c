@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include "motor.h"
 #include "system.h"
+#include "cfgstore.h"
 #include "uart.h"
 #include "eventlog.h"
 #include "util.h"
@@ -23,6 +24,7 @@
 #include "tsdz2/stm8s/stm8s.h"
 #include "tsdz2/stm8s/stm8s_tim1.h"
 #include "tsdz2/stm8s/stm8s_itc.h"
+#include "tsdz2/stm8s/stm8s_exti.h"
 #include "tsdz2/stm8s/stm8s_adc1.h"
 #include "tsdz2/stm8s/stm8s_flash.h"
 
@@ -35,53 +37,169 @@
 #define MAX_MOTOR_PHASE_CURRENT_AMPS_X10	300
 
 
-// Maximum current ramp
+// Current ramp
 // ----------------------------------------------
-// Every second has 15625 pwm cycles interrupts,
+// Every second has pwm_cycles_second pwm cycles interrupts,
 // one ADC battery current step  -> 0.156 amps:
 //
 // A / 0.156 = X (we need to do X steps ramp up per second)
 // Therefore :
-// 15625 / (A / 0.156) => (15625 * 0.156) / A
+// pwm_cycles_second / (A / 0.156) => (pwm_cycles_second * 0.156) / A
 //
-// 20A/s: (15625 * 0.156) / 20 = 135
-#define CURRENT_RAMP_UP_INVERSE_STEP			135
+// Configured current_ramp_amps_s is applied here at pwm cycle resolution,
+// in steps of 1/4 ADC step (oversampled battery current).
+// Throttle (fast ramp) uses at least CURRENT_RAMP_UP_FAST_AMPS_S.
+#define CURRENT_RAMP_UP_DEFAULT_AMPS_S			20
+#define CURRENT_RAMP_UP_FAST_AMPS_S				20
 
 // Choose PWM ramp up/down step (higher value will make the motor acceleration slower)
 //
-// For a 24V battery, 25 for ramp up seems ok. For an higher voltage battery, this values should be higher
+// Values were previously used unscaled for all batteries, mostly 36V/48V. They are
+// scaled with battery voltage at runtime relative to 48V, so that the applied voltage
+// changes at the same rate (V/s) independent of battery. At 48V the ramp is unchanged,
+// lower voltage batteries get the same rate in V/s as 48V.
 #define PWM_DUTY_CYCLE_RAMP_UP_INVERSE_STEP		24
 #define PWM_DUTY_CYCLE_RAMP_DOWN_INVERSE_STEP	28
+#define PWM_DUTY_CYCLE_RAMP_REFERENCE_VOLTAGE	48
+#define PWM_DUTY_CYCLE_RAMP_REFERENCE_CYCLES	15625U	// pwm cycles per second
 
 // This value should be near 0.
-// You can try to tune with the whell on the air, full throttle and look at batttery current: adjust for lower battery current
+// Default used until motor_start_calibration() has been run, which finds the
+// offset giving the lowest battery current with the wheel in the air.
 #define MOTOR_ROTOR_OFFSET_ANGLE				11
 
-// This value is ERPS speed after which a transition happens from sinewave no interpolation to have
-// interpolation 60 degrees and must be found experimentally
-#define MOTOR_ROTOR_ERPS_START_INTERPOLATION_60_DEGREES 10
+// This value is ERPS speed after which a transition happens from sinewave no interpolation to
+// rotor angle observer and must be found experimentally
+#define MOTOR_ROTOR_ERPS_START_OBSERVER			10
 
-#define PWM_CYCLES_COUNTER_MAX					3125U	// 5 erps minimum speed; 1/5 = 200ms; 200ms/64us = 3125
-#define PWM_CYCLES_SECOND						15625U	// 1 / 64us (PWM period)
+// Rotor angle observer
+// ----------------------------------------------
+// Phase locked loop tracking rotor angle (1/256 svm table index) between hall
+// sensor transitions, advanced every pwm cycle. Phase error is measured at each
+// transition and the loop is updated once per sector (PI):
+//
+//   angle    += Kp * error                         Kp = 1/2
+//   integral += Ki * error                         Ki = 1/8, clamped
+//   speed     = (sector angle + (1 - Kp) * error + integral) / last sector period
+//
+// Speed from the last sector period lags under acceleration, the integral
+// removes the resulting steady phase error (a few degrees at moderate
+// acceleration without it). Ki = 1/8 settles in about 2 electrical revolutions
+// with little added hall sensor placement jitter, higher values get noisier.
+// If motor decelerates the estimate stops a margin past the next transition.
+#define ROTOR_OBSERVER_MAX_ERROR_X256			(32 << 8)
+#define ROTOR_OBSERVER_OVERSHOOT_X256			(8 << 8)
+#define ROTOR_OBSERVER_KI_SHIFT					3
+#define ROTOR_OBSERVER_MAX_INTEGRAL_X256		(8 << 8)
+
+// Hall sensor timestamps
+// ----------------------------------------------
+// Hall sensor transitions are timestamped in external interrupt handlers
+// (higher priority than the pwm interrupt) as pwm cycle number and timer1
+// ticks (62.5ns) since the cc4 interrupt of that pwm cycle. The pwm interrupt
+// uses the sector period in 1/16 pwm cycles, speed_erps is calculated from
+// the electrical revolution period in main loop.
+#define HALL_SECTOR_PERIOD_X16_MIN				16
+#define HALL_SECTOR_PERIOD_X16_MAX				4095
+
+// timer1 ticks to 1/16 pwm cycles, ticks / 4 fits 8 bits at all pwm frequencies
+#define PWM_TICKS_X16(TICKS)					\
+	((uint8_t)(((uint16_t)(uint8_t)((TICKS) >> 2) * pwm_ticks_x16_scale) >> 8))
+
+// Pwm frequency
+// ----------------------------------------------
+// Configurable, constants counted in pwm cycles are computed from the pwm
+// period when frequency is set. Execution time of the pwm interrupt is measured
+// during PWM_ISR_LOAD_TEST_MS at init, before motor can be enabled. Hall edge
+// processing and current/speed control are not executed with the motor stopped,
+// a lower limit is used for the test to leave margin for those.
+// If the load is too high the configured frequency is changed to 15.6kHz
+// and saved. The load is also checked while running, if it exceeds
+// PWM_ISR_MAX_LOAD_PERCENT the same is done when motor is disabled.
+#define PWM_ISR_MAX_LOAD_PERCENT				80
+#define PWM_ISR_TEST_MAX_LOAD_PERCENT			60
+#define PWM_ISR_LOAD_TEST_MS					100
+#define PWM_ISR_LOAD_CHECK_INTERVAL_MS			1000
+
+#define PWM_CYCLES_COUNTER_MIN_ERPS				5		// 5 erps minimum speed; 1/5 = 200ms
 #define PWM_DUTY_CYCLE_MAX						254
 #define PWM_DUTY_CYCLE_MIN						20
 
-#define MOTOR_ROTOR_ANGLE_90					(63  + MOTOR_ROTOR_OFFSET_ANGLE)
-#define MOTOR_ROTOR_ANGLE_150					(106 + MOTOR_ROTOR_OFFSET_ANGLE)
-#define MOTOR_ROTOR_ANGLE_210					(148 + MOTOR_ROTOR_OFFSET_ANGLE)
-#define MOTOR_ROTOR_ANGLE_270					(191 + MOTOR_ROTOR_OFFSET_ANGLE)
-#define MOTOR_ROTOR_ANGLE_330					(233 + MOTOR_ROTOR_OFFSET_ANGLE)
-#define MOTOR_ROTOR_ANGLE_30					(20  + MOTOR_ROTOR_OFFSET_ANGLE)
+// Default rotor angle at hall sensor transitions, offset angle not included
+#define MOTOR_ROTOR_ANGLE_90					63
+#define MOTOR_ROTOR_ANGLE_150					106
+#define MOTOR_ROTOR_ANGLE_210					148
+#define MOTOR_ROTOR_ANGLE_270					191
+#define MOTOR_ROTOR_ANGLE_330					233
+#define MOTOR_ROTOR_ANGLE_30					20
 
 // motor maximum rotation
 // 700 is equal to 124 cadence, as TSDZ2 has a reduction ratio of 41.8
 #define MAX_MOTOR_SPEED_ERPS					700 
 
 // Set how often the motor speed limit controller runs in the isr
-#define SPEED_CONTROLLER_CHECK_PERIODS			2000
+#define SPEED_CONTROLLER_CHECK_PERIOD_MS		128
 
 // Set how oftern the current controller runs in the isr
-#define CURRENT_CONTROLLER_CHECK_PERIODS		14
+#define CURRENT_CONTROLLER_CHECK_PERIOD_US		896
+
+// Motor inductance
+// ----------------------------------------------
+// 36 V motor: L = 76uH
+// 48 V motor: L = 135uH
+// 142 (x1048576) was verified experimentaly on 2018.07 to be near the best value for a 48V motor.
+// Test done with a fixed mechanical load, duty_cycle = 200 and 100 and measured battery current was 16 and 6 (10 and 4 amps)
+//
+// Used until identified at runtime, unless overridden by configuration.
+#define MOTOR_INDUCTANCE_DEFAULT_X1048576		142
+#define MOTOR_INDUCTANCE_MIN_X1048576			40
+#define MOTOR_INDUCTANCE_MAX_X1048576			255
+
+// Motor parameter identification
+// ----------------------------------------------
+// With phase current in phase with back-emf (which is what the foc angle is for)
+// the applied phase voltage is: V^2 = (E + I*R)^2 + (I*w*L)^2, where E = Ke * w.
+// Ke is identified when running with almost no load, R at low speed and
+// L at high speed when loaded. Same units as in compute_foc_angle().
+#define MOTOR_IDENT_INTERVAL_MS					100
+#define MOTOR_IDENT_MIN_DUTY_CYCLE				30
+#define MOTOR_IDENT_KE_MIN_ERPS					100
+#define MOTOR_IDENT_KE_MAX_ADC_CURRENT			6		// ~1A
+#define MOTOR_IDENT_R_MIN_ERPS					50
+#define MOTOR_IDENT_R_MAX_ERPS					150
+#define MOTOR_IDENT_L_MIN_ERPS					300
+#define MOTOR_IDENT_LOAD_MIN_ADC_CURRENT		32		// ~5A
+#define MOTOR_IDENT_MIN_SAMPLES					20
+#define MOTOR_IDENT_L_SAMPLES					100
+#define MOTOR_IDENT_KE_SAVE_SAMPLES				100
+#define MOTOR_IDENT_FILTER_COEFFICIENT			4
+
+// Rotor calibration
+// ----------------------------------------------
+// Motor is run unloaded (wheel in the air) at a fixed duty cycle. First the
+// real timing of each hall sensor sector is measured, then the rotor offset
+// angle is swept to find the offset giving the lowest battery current.
+#define ROTOR_CALIBRATION_PWM_DUTY_CYCLE		160
+#define ROTOR_CALIBRATION_MAX_CURRENT_AMPS_X10	50
+#define ROTOR_CALIBRATION_MIN_ERPS				40
+#define ROTOR_CALIBRATION_SPIN_UP_MS			3000
+#define ROTOR_CALIBRATION_MEASURE_HALL_MS		2000
+#define ROTOR_CALIBRATION_SWEEP_RANGE			16
+#define ROTOR_CALIBRATION_SWEEP_STEP			2
+#define ROTOR_CALIBRATION_SETTLE_MS				300
+#define ROTOR_CALIBRATION_MEASURE_MS			700
+
+#define ROTOR_CALIBRATION_IDLE					0
+#define ROTOR_CALIBRATION_SPIN_UP				1
+#define ROTOR_CALIBRATION_MEASURE_HALL			2
+#define ROTOR_CALIBRATION_SWEEP_SETTLE			3
+#define ROTOR_CALIBRATION_SWEEP_MEASURE			4
+
+// reported as data of EVT_ERROR_MOTOR_CALIBRATION
+#define ROTOR_CALIBRATION_ERROR_BRAKE			1
+#define ROTOR_CALIBRATION_ERROR_LVC				2
+#define ROTOR_CALIBRATION_ERROR_HALL_SENSOR		3
+#define ROTOR_CALIBRATION_ERROR_SPEED			4
 
 // adc measurements
 // ------------------------------------------
@@ -92,6 +210,18 @@
 
 #define ADC_10BIT_STEPS_PER_VOLT_X512			5953
 
+// battery current is sampled once per pwm cycle at middle of pwm duty cycle,
+// values named x4 are a moving sum of the samples from the last 4 pwm cycles,
+// not oversampling of one instant, a current step reaches the limiter
+// fully after 4 pwm cycles, 0.039A per step
+#define BATTERY_CURRENT_OVERSAMPLING			4
+
+// iterations to wait for battery current conversion when not yet complete
+#define ADC_CURRENT_EOC_MAX_WAIT				8
+// consecutive missed battery current conversions before duty cycle
+// is forced down, current limiter runs on stale samples meanwhile
+#define ADC_CURRENT_MAX_MISSED_SAMPLES			4
+
 
 // filter coefficients
 #define BATTERY_CURRENT_FILTER_COEFFICIENT		2
@@ -101,11 +231,30 @@
 
 #define SVM_TABLE_LEN							256
 #define SVM_TABLE_MIDDLE						127
+
+// Dead time compensation
+// ----------------------------------------------
+// During dead time the phase voltage is decided by the direction of the phase current
+// (freewheeling diode), current out of the phase loses one dead time of high side on time
+// each pwm period, current into the phase gains it. Compare value is 2 timer ticks of
+// on time in center aligned mode. Current is in phase with back-emf (foc angle),
+// not compensated at low current where direction is uncertain.
+#define DEAD_TIME_COMPENSATION					(TIM1_DEAD_TIME_TICKS / 2)
+#define DEAD_TIME_COMPENSATION_MIN_ADC_CURRENT	6		// ~1A
+
+// Second half of svm table has the same values as first half (negative offset),
+// duty cycle scaled table only holds the first half. Two tables are kept, the
+// main loop builds the inactive one and then swaps the active index.
+// Share of pwm cycles using the table (hit rate) is logged while motor is running.
+#define SVM_DUTY_TABLE_LEN						128
+#define SVM_DUTY_TABLE_BUILD_STEP				32
+#define SVM_DUTY_TABLE_NONE						0xff
+#define SVM_DUTY_TABLE_REPORT_INTERVAL_MS		1000
 #define SIN_TABLE_LEN							60
 
  // motor states
 #define BLOCK_COMMUTATION						1
-#define SINEWAVE_INTERPOLATION_60_DEGREES		2
+#define SINEWAVE_OBSERVER						2
 
 
 // index 0-256 to degrees 0-360
@@ -130,6 +279,25 @@ static const uint8_t svm_table[SVM_TABLE_LEN] = {
 };
 
 
+// rotor angle at hall sensor transition, indexed by hall sensor state
+static const uint8_t default_hall_angles[8] =
+{
+	0,
+	MOTOR_ROTOR_ANGLE_210,	// 1
+	MOTOR_ROTOR_ANGLE_90,	// 2
+	MOTOR_ROTOR_ANGLE_150,	// 3
+	MOTOR_ROTOR_ANGLE_330,	// 4
+	MOTOR_ROTOR_ANGLE_270,	// 5
+	MOTOR_ROTOR_ANGLE_30,	// 6
+	0
+};
+
+// hall sensors sequence with motor forward rotation
+static const uint8_t hall_sequence[6] = { 4, 6, 2, 3, 1, 5 };
+
+// next hall sensor state with motor forward rotation, indexed by hall sensor state
+static const uint8_t hall_next_state[8] = { 0, 5, 3, 1, 6, 4, 2, 0 };
+
 static const uint8_t sin_table[SIN_TABLE_LEN] =
 {
 	  0,   3,   6,   9,  12,  16,  19,  22,  25,  28,  31,  34,  37,  40,  43,
@@ -151,23 +319,86 @@ static volatile uint8_t control_state = CONTROL_STATE_DISABLE;
 static volatile bool is_lvc_triggered = false;
 static volatile bool hall_sensor_error = false;
 
-// not atomic, protected by disabling interrupt while read in compute_foc_angle
-static volatile uint16_t speed_erps = 0; 
+// calculated in main loop, not atomic, written with interrupt disabled
+static volatile uint16_t speed_erps = 0;
+
+// electrical revolution period measured from hall sensor timestamps, 0 when stopped,
+// not atomic, protected by disabling interrupt while read in read_motor_speed
+static volatile uint16_t hall_erev_pwm_cycles = 0;
+static volatile int16_t hall_erev_ticks = 0;
 
-// current reading saved in 8 bits for atomic access, not expected to exceed 255 (40A)
-static volatile uint8_t adc_battery_current = 0;	
+// oversampled battery current (10bit x4), not atomic, protected by disabling interrupt
+static volatile uint16_t adc_battery_current_x4 = 0;
+static volatile uint16_t adc_battery_target_current_x4 = 0;
+
+// phase current saved in 8 bits for atomic access, saturated at 255 (40A)
 static volatile uint8_t adc_phase_current = 0;
-static volatile uint8_t adc_battery_target_current = 0;
 
 static volatile uint8_t foc_angle = 0;
 
 static volatile uint8_t pwm_duty_cycle = 0;
 static volatile uint8_t pwm_duty_cycle_target = 0;
 
+// duty cycle ramp steps scaled with battery voltage, calculated in main loop
+static volatile uint8_t pwm_duty_cycle_ramp_up_inverse_step = PWM_DUTY_CYCLE_RAMP_UP_INVERSE_STEP;
+static volatile uint8_t pwm_duty_cycle_ramp_down_inverse_step = PWM_DUTY_CYCLE_RAMP_DOWN_INVERSE_STEP;
+
+// svm tables scaled by duty cycle, built in main loop when duty cycle is stable,
+// isr only reads the active table and only if built for current duty cycle +-1,
+// duty cycle toggles by one step in steady state, error is 1/256 of amplitude.
+static volatile uint8_t svm_duty_tables[2][SVM_DUTY_TABLE_LEN];
+static volatile uint8_t svm_duty_table_duty_cycle[2];
+static volatile uint8_t svm_duty_table_active = SVM_DUTY_TABLE_NONE;
+static volatile uint16_t svm_duty_table_hits = 0;
+
+// duty cycle matching back-emf at current speed, calculated in main loop while disabled
+static volatile uint8_t pwm_duty_cycle_restart = 0;
+
+// pwm period dependent values, only changed with pwm interrupt disabled
+static const uint16_t pwm_auto_reload_periods[3] = { TIM1_AUTO_RELOAD_PERIOD, 410, 342 };
+static uint8_t pwm_frequency = PWM_FREQUENCY_15_6KHZ;
+static uint16_t pwm_period_ticks = 2 * TIM1_AUTO_RELOAD_PERIOD;
+static uint16_t pwm_cc4_compare = TIM1_CC4_COMPARE;
+static uint16_t pwm_center_ticks = (TIM1_AUTO_RELOAD_PERIOD + 1) / 2;
+static uint16_t pwm_max_compare_ticks = TIM1_AUTO_RELOAD_PERIOD;
+static uint8_t pwm_output_scale = 0; // duty cycle scale x256, 0 if not scaled
+static uint8_t pwm_ticks_x16_scale = 16;
+static uint16_t pwm_cycles_second = 0;
+static uint16_t pwm_cycles_counter_max = 0;
+static uint16_t observer_start_erev_pwm_cycles = 0;
+static uint16_t speed_controller_check_periods = 0;
+static uint8_t current_controller_check_periods = 0;
+
+// longest pwm interrupt execution time, timer1 ticks
+static volatile uint16_t pwm_isr_max_ticks = 0;
+
+// hall angles including rotor offset, indexed by hall sensor state
+static volatile uint8_t rotor_angles[8];
+
+// last hall sensor transition, latched by external interrupt, sequence is
+// incremented on every write and used to read a consistent copy in pwm interrupt
+static volatile uint8_t hall_edge_state = 0;
+static volatile uint8_t hall_edge_pwm_cycle = 0;
+static volatile uint16_t hall_edge_ticks = 0;
+static volatile uint8_t hall_edge_sequence = 0;
+
+// pwm cycle number (8bit for atomic access), incremented at start of pwm interrupt,
+// copied to pwm_cycle_done when cc4 pending flag has been cleared at end of interrupt
+static volatile uint8_t pwm_cycle = 0;
+static volatile uint8_t pwm_cycle_done = 0;
+
+// hall sector timing used by calibration, not atomic, protected by disabling interrupt
+static volatile bool rotor_calibration_measure_hall = false;
+static volatile uint16_t hall_sector_pwm_cycles[8];
+
 // calculated constant limits (from config)
 static uint16_t adc_low_voltage_limit = 0;
-static uint8_t adc_battery_max_current = 0;
+static uint16_t adc_battery_max_current_x4 = 0;
 static uint8_t adc_phase_max_current = 0;
+static uint16_t adc_current_ramp_up_inverse_step = 0;
+static uint16_t adc_current_ramp_up_fast_inverse_step = 0;
+static uint8_t current_ramp_amps_s = CURRENT_RAMP_UP_DEFAULT_AMPS_S;
+static volatile bool current_ramp_fast = false;
 
 // ------------------------------------------------------
 
@@ -180,6 +411,7 @@ static uint16_t adc_battery_voltage_filtered = 0;
 
 // battery current filter
 static uint16_t adc_battery_current_accumulated = 0;
+static uint16_t adc_battery_current_filtered_x4 = 0;
 static uint16_t adc_battery_current_filtered = 0;
 
 // motor phase current filter
@@ -192,6 +424,33 @@ static uint8_t target_current_percent = 0;
 
 static uint16_t adc_steps_per_volt_x512 = ADC_10BIT_STEPS_PER_VOLT_X512;
 
+// rotor calibration
+static uint8_t hall_angles[8];
+static uint8_t rotor_offset_angle = MOTOR_ROTOR_OFFSET_ANGLE;
+
+static uint8_t rotor_calibration_state = ROTOR_CALIBRATION_IDLE;
+static uint32_t rotor_calibration_state_ms = 0;
+static uint8_t rotor_calibration_sweep_steps = 0;
+static uint8_t rotor_calibration_best_offset = 0;
+static uint16_t rotor_calibration_best_current_x16 = 0;
+static uint32_t rotor_calibration_current_sum = 0;
+static uint32_t rotor_calibration_current_samples = 0;
+
+// motor parameter identification
+static uint8_t motor_inductance_x1048576 = MOTOR_INDUCTANCE_DEFAULT_X1048576;
+static uint8_t motor_inductance_seed_x1048576 = MOTOR_INDUCTANCE_DEFAULT_X1048576;
+static bool motor_inductance_override = false;
+static bool motor_inductance_saved = false;
+static bool motor_ke_saved = false;
+static uint32_t motor_ident_last_ms = 0;
+static uint16_t ke_x256_accumulated = 0;
+static uint16_t r_x1024_accumulated = 0;
+static uint16_t l_x1048576_accumulated = 0;
+static uint8_t ke_samples = 0;
+static uint8_t r_samples = 0;
+static uint8_t l_samples = 0;
+static bool pstate_save_pending = false;
+
 
 static void flash_opt2_afr5()
 {
@@ -228,6 +487,39 @@ static void flash_opt2_afr5()
 	}
 }
 
+static void read_motor_speed()
+{
+	static uint16_t last_erev_pwm_cycles = 0;
+	static int16_t last_erev_ticks = 0;
+
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+	uint16_t erev_pwm_cycles = hall_erev_pwm_cycles;
+	int16_t erev_ticks = hall_erev_ticks;
+	TIM1->IER |= TIM1_IT_CC4;
+
+	if (erev_pwm_cycles == last_erev_pwm_cycles && erev_ticks == last_erev_ticks)
+	{
+		return;
+	}
+
+	last_erev_pwm_cycles = erev_pwm_cycles;
+	last_erev_ticks = erev_ticks;
+
+	uint16_t erps = 0;
+	if (erev_pwm_cycles > 0)
+	{
+		int32_t period_ticks = (int32_t)erev_pwm_cycles * pwm_period_ticks + erev_ticks;
+		if (period_ticks > 0)
+		{
+			erps = (uint16_t)(TIM1_CLOCK_HZ / (uint32_t)period_ticks);
+		}
+	}
+
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+	speed_erps = erps;
+	TIM1->IER |= TIM1_IT_CC4;
+}
+
 static void read_battery_voltage()
 {
 	// low pass filter the voltage readed value, to avoid possible fast spikes/noise
@@ -238,110 +530,858 @@ static void read_battery_voltage()
 	is_lvc_triggered = (adc_battery_voltage_filtered < adc_low_voltage_limit);
 }
 
-static void read_battery_current()
+static uint8_t scale_duty_cycle_ramp_step(uint8_t inverse_step)
+{
+	// inverse_step * voltage / reference voltage, in pwm cycles at reference frequency
+	uint32_t step = ((uint32_t)inverse_step * adc_battery_voltage_filtered * 512) /
+		((uint32_t)PWM_DUTY_CYCLE_RAMP_REFERENCE_VOLTAGE * adc_steps_per_volt_x512);
+	step = (step * pwm_cycles_second) / PWM_DUTY_CYCLE_RAMP_REFERENCE_CYCLES;
+
+	if (step < 1)
+	{
+		step = 1;
+	}
+	else if (step > 255)
+	{
+		step = 255;
+	}
+
+	return (uint8_t)step;
+}
+
+static void compute_duty_cycle_ramp_steps()
+{
+	static uint16_t last_adc_battery_voltage = 0;
+	static uint16_t last_pwm_cycles_second = 0;
+
+	// duty cycle step is battery voltage / 256, keep ramp rate in V/s constant
+	if (adc_battery_voltage_filtered == last_adc_battery_voltage &&
+		pwm_cycles_second == last_pwm_cycles_second)
+	{
+		return;
+	}
+
+	last_adc_battery_voltage = adc_battery_voltage_filtered;
+	last_pwm_cycles_second = pwm_cycles_second;
+
+	pwm_duty_cycle_ramp_up_inverse_step = scale_duty_cycle_ramp_step(PWM_DUTY_CYCLE_RAMP_UP_INVERSE_STEP);
+	pwm_duty_cycle_ramp_down_inverse_step = scale_duty_cycle_ramp_step(PWM_DUTY_CYCLE_RAMP_DOWN_INVERSE_STEP);
+}
+
+static void read_battery_current()
+{
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+	uint16_t current_x4 = adc_battery_current_x4;
+	TIM1->IER |= TIM1_IT_CC4;
+
+	// low pass filter the positive battery readed value (no regen current), to avoid possible fast spikes/noise
+	adc_battery_current_accumulated -= adc_battery_current_accumulated >> BATTERY_CURRENT_FILTER_COEFFICIENT;
+	adc_battery_current_accumulated += current_x4;
+	adc_battery_current_filtered_x4 = adc_battery_current_accumulated >> BATTERY_CURRENT_FILTER_COEFFICIENT;
+	adc_battery_current_filtered = adc_battery_current_filtered_x4 / BATTERY_CURRENT_OVERSAMPLING;
+}
+
+static void set_battery_target_current(uint16_t current_x4)
+{
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+	adc_battery_target_current_x4 = current_x4;
+	TIM1->IER |= TIM1_IT_CC4;
+}
+
+static void read_phase_current()
+{
+	// low pass filter the positive motor pahse value (no regen current), to avoid possible fast spikes/noise
+	adc_phase_current_accumulated -= adc_phase_current_accumulated >> PHASE_CURRENT_FILTER_COEFFICIENT;
+	adc_phase_current_accumulated += adc_phase_current;
+	adc_phase_current_filtered = adc_phase_current_accumulated >> PHASE_CURRENT_FILTER_COEFFICIENT;
+}
+
+static void update_svm_duty_table()
+{
+	static uint8_t build_duty_cycle = 0;
+	static uint8_t build_output_scale = 0;
+	static uint8_t build_index = 0;
+	static uint8_t build_table = 0;
+
+	uint8_t duty = pwm_duty_cycle;
+	// rebuilt for exact duty cycle when stable,
+	// active table is still used by isr meanwhile if within +-1
+	uint8_t active = svm_duty_table_active;
+	if (active != SVM_DUTY_TABLE_NONE && duty == svm_duty_table_duty_cycle[active])
+	{
+		return;
+	}
+
+	if (duty != build_duty_cycle || pwm_output_scale != build_output_scale)
+	{
+		// duty cycle changed, wait until it is stable before building
+		build_duty_cycle = duty;
+		build_output_scale = pwm_output_scale;
+		build_index = 0;
+		return;
+	}
+
+	// duty cycle scaled to pwm period, same as in pwm interrupt
+	uint8_t output_duty = duty;
+	if (build_output_scale != 0)
+	{
+		output_duty = (uint8_t)(((uint16_t)duty * build_output_scale) >> 8);
+	}
+
+	// build inactive table in parts to not block main loop
+	if (build_index == 0)
+	{
+		build_table = active == 0 ? 1 : 0;
+	}
+
+	uint8_t end = build_index + SVM_DUTY_TABLE_BUILD_STEP;
+	while (build_index < end)
+	{
+		svm_duty_tables[build_table][build_index] = (uint8_t)(((uint16_t)output_duty * svm_table[build_index]) >> 8);
+		build_index++;
+	}
+
+	if (build_index >= SVM_DUTY_TABLE_LEN)
+	{
+		// table is complete, swap
+		svm_duty_table_duty_cycle[build_table] = duty;
+		svm_duty_table_active = build_table;
+		build_index = 0;
+	}
+}
+
+static void report_svm_duty_table_hit_rate()
+{
+	static uint32_t last_report_ms = 0;
+	static uint8_t last_percent = 0;
+
+	uint32_t now = system_ms();
+	uint32_t elapsed_ms = now - last_report_ms;
+	if (elapsed_ms < SVM_DUTY_TABLE_REPORT_INTERVAL_MS)
+	{
+		return;
+	}
+
+	last_report_ms = now;
+
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+	uint16_t hits = svm_duty_table_hits;
+	svm_duty_table_hits = 0;
+	TIM1->IER |= TIM1_IT_CC4;
+
+	if (control_state != CONTROL_STATE_RUNNING)
+	{
+		return;
+	}
+
+	uint32_t cycles = ((uint32_t)pwm_cycles_second * elapsed_ms) / 1000;
+	uint8_t percent = (uint8_t)(((uint32_t)hits * 100) / cycles);
+	if (percent / 10 != last_percent / 10)
+	{
+		eventlog_write_data(EVT_DATA_SVM_TABLE_HIT_RATE, percent);
+	}
+	last_percent = percent;
+}
+
+static uint8_t asin_table(uint8_t inverted_angle_x128)
+{
+	// calc asin also converts the final result to degrees
+	uint8_t index = 0;
+	while (index < SIN_TABLE_LEN)
+	{
+		if (inverted_angle_x128 < sin_table[index])
+		{
+			break;
+		}
+
+		index++;
+	}
+
+	// first value of table is 0 so index will always increment to at least 1 and return 0
+	return index--;
+}
+
+static void compute_foc_angle()
+{
+	uint16_t ui16_temp;
+	uint32_t ui32_temp;
+	uint16_t e_phase_voltage;
+	uint32_t i_phase_current_x2;
+	uint32_t w_angular_velocity_x16;
+	uint16_t iwl_128;
+
+	// FOC implementation by calculating the angle between phase current and rotor magnetic flux (BEMF)
+	// 1. phase voltage is calculate
+	// 2. I*w*L is calculated, where I is the phase current. L is identified or configured.
+	// 3. inverse sin is calculated of (I*w*L) / phase voltage, were we obtain the angle
+	// 4. previous calculated angle is applied to phase voltage vector angle and so the
+	// angle between phase current and rotor magnetic flux (BEMF) is kept at 0 (max torque per amp)
+
+	// calc E phase voltage
+	ui16_temp = adc_battery_voltage_filtered * ADC_10BIT_VOLTAGE_PER_ADC_STEP_X512;
+	ui16_temp = (ui16_temp >> 8) * pwm_duty_cycle;
+	e_phase_voltage = ui16_temp >> 9;
+
+	// calc I phase current
+	if (pwm_duty_cycle > 10)
+	{
+		ui16_temp = ((uint16_t)adc_battery_current_filtered) * ADC_10BIT_CURRENT_PER_ADC_STEP_X512;
+		i_phase_current_x2 = ui16_temp / pwm_duty_cycle;
+	}
+	else
+	{
+		i_phase_current_x2 = 0;
+	}
+
+	// calc W angular velocity: erps * 6.3
+	// 101 = 6.3 * 16
+	w_angular_velocity_x16 = speed_erps * 101;
+
+	// calc IwL
+	ui32_temp = i_phase_current_x2 * motor_inductance_x1048576;
+	ui32_temp *= w_angular_velocity_x16;
+	iwl_128 = ui32_temp >> 18;
+
+	// calc FOC angle
+	uint8_t foc_angle_unfiltered = asin_table(iwl_128 / e_phase_voltage);
+
+	// low pass filter FOC angle
+	foc_angle_accumulated -= foc_angle_accumulated >> 4;
+	foc_angle_accumulated += foc_angle_unfiltered;
+	foc_angle = foc_angle_accumulated >> 4;
+}
+
+static uint16_t isqrt32(uint32_t value)
+{
+	uint32_t result = 0;
+	uint32_t bit = 1ul << 30;
+
+	while (bit > value)
+	{
+		bit >>= 2;
+	}
+
+	while (bit != 0)
+	{
+		if (value >= result + bit)
+		{
+			value -= result + bit;
+			result = (result >> 1) + bit;
+		}
+		else
+		{
+			result >>= 1;
+		}
+
+		bit >>= 2;
+	}
+
+	return (uint16_t)result;
+}
+
+static uint16_t filter_motor_parameter(uint16_t* accumulated, uint8_t* samples, uint16_t value)
+{
+	if (*samples == 0)
+	{
+		*accumulated = value << MOTOR_IDENT_FILTER_COEFFICIENT;
+	}
+	else
+	{
+		*accumulated -= *accumulated >> MOTOR_IDENT_FILTER_COEFFICIENT;
+		*accumulated += value;
+	}
+
+	if (*samples < 255)
+	{
+		(*samples)++;
+	}
+
+	return *accumulated >> MOTOR_IDENT_FILTER_COEFFICIENT;
+}
+
+static void load_motor_inductance()
+{
+	motor_inductance_override = g_config.motor_inductance_uh != 0;
+
+	if (motor_inductance_override)
+	{
+		// 1048576 / 1000000 ~= 67 / 64
+		uint16_t l_x1048576 = ((uint16_t)g_config.motor_inductance_uh * 67) >> 6;
+		if (l_x1048576 > MOTOR_INDUCTANCE_MAX_X1048576)
+		{
+			l_x1048576 = MOTOR_INDUCTANCE_MAX_X1048576;
+		}
+
+		motor_inductance_x1048576 = (uint8_t)l_x1048576;
+		motor_inductance_seed_x1048576 = (uint8_t)l_x1048576;
+	}
+	else if (g_pstate.motor_inductance_x1048576 != 0)
+	{
+		motor_inductance_x1048576 = g_pstate.motor_inductance_x1048576;
+	}
+	else
+	{
+		motor_inductance_x1048576 = MOTOR_INDUCTANCE_DEFAULT_X1048576;
+	}
+}
+
+static void load_motor_ke()
+{
+	uint16_t ke_x256 = EXPAND_U16(g_pstate.motor_ke_x256_u16h, g_pstate.motor_ke_x256_u16l);
+	if (ke_x256 != 0)
+	{
+		// continue filtering from stored value, usable before identified in this power cycle
+		ke_x256_accumulated = ke_x256 << MOTOR_IDENT_FILTER_COEFFICIENT;
+		ke_samples = MOTOR_IDENT_MIN_SAMPLES;
+	}
+}
+
+static void save_motor_ke(uint16_t ke_x256)
+{
+	// at most once per power cycle, only if identified value differs more than 10%
+	if (motor_ke_saved)
+	{
+		return;
+	}
+
+	motor_ke_saved = true;
+
+	uint16_t stored = EXPAND_U16(g_pstate.motor_ke_x256_u16h, g_pstate.motor_ke_x256_u16l);
+	uint16_t diff = stored > ke_x256 ? stored - ke_x256 : ke_x256 - stored;
+
+	if (stored == 0 || diff > stored / 10)
+	{
+		g_pstate.motor_ke_x256_u16l = (uint8_t)ke_x256;
+		g_pstate.motor_ke_x256_u16h = (uint8_t)(ke_x256 >> 8);
+		pstate_save_pending = true;
+	}
+}
+
+static void save_motor_inductance()
+{
+	// at most once per power cycle, only if identified value differs more than 10%
+	if (motor_inductance_saved)
+	{
+		return;
+	}
+
+	motor_inductance_saved = true;
+
+	uint8_t stored = g_pstate.motor_inductance_x1048576;
+	uint8_t diff = stored > motor_inductance_x1048576 ?
+		stored - motor_inductance_x1048576 : motor_inductance_x1048576 - stored;
+
+	if (stored == 0 || diff > stored / 10)
+	{
+		g_pstate.motor_inductance_x1048576 = motor_inductance_x1048576;
+		pstate_save_pending = true;
+
+		// 1000000 / 1048576 ~= 61 / 64
+		eventlog_write_data(EVT_DATA_MOTOR_INDUCTANCE, ((uint16_t)motor_inductance_x1048576 * 61) >> 6);
+	}
+}
+
+static void save_pstate_if_idle()
+{
+	// eeprom write is deferred until motor is stopped, never while riding
+	if (pstate_save_pending && control_state == CONTROL_STATE_DISABLE)
+	{
+		pstate_save_pending = false;
+		cfgstore_save_pstate();
+	}
+}
+
+static void identify_motor_parameters()
+{
+	uint32_t now = system_ms();
+	if (now - motor_ident_last_ms < MOTOR_IDENT_INTERVAL_MS)
+	{
+		return;
+	}
+
+	motor_ident_last_ms = now;
+
+	uint8_t duty = pwm_duty_cycle;
+	uint16_t erps = speed_erps;
+
+	if (control_state != CONTROL_STATE_RUNNING ||
+		rotor_calibration_state != ROTOR_CALIBRATION_IDLE ||
+		duty < MOTOR_IDENT_MIN_DUTY_CYCLE ||
+		erps < MOTOR_IDENT_R_MIN_ERPS)
+	{
+		return;
+	}
+
+	// applied phase voltage (volts x128) and phase current (amps x2)
+	uint32_t v_x128 = ((uint32_t)adc_battery_voltage_filtered * ADC_10BIT_VOLTAGE_PER_ADC_STEP_X512 * duty) >> 10;
+	uint32_t v2 = v_x128 * v_x128;
+	uint16_t i_x2 = ((uint16_t)adc_battery_current_filtered * ADC_10BIT_CURRENT_PER_ADC_STEP_X512) / duty;
+
+	if (adc_battery_current_filtered <= MOTOR_IDENT_KE_MAX_ADC_CURRENT)
+	{
+		// almost no load, applied voltage is all back-emf
+		if (erps >= MOTOR_IDENT_KE_MIN_ERPS)
+		{
+			uint32_t ke_x256 = (v_x128 << 8) / erps;
+			if (ke_x256 < 4096)
+			{
+				uint16_t ke_filtered = filter_motor_parameter(&ke_x256_accumulated, &ke_samples, (uint16_t)ke_x256);
+				if (ke_samples >= MOTOR_IDENT_KE_SAVE_SAMPLES)
+				{
+					save_motor_ke(ke_filtered);
+				}
+			}
+		}
+
+		return;
+	}
+
+	if (adc_battery_current_filtered < MOTOR_IDENT_LOAD_MIN_ADC_CURRENT || ke_samples < MOTOR_IDENT_MIN_SAMPLES)
+	{
+		return;
+	}
+
+	uint32_t e_x128 = ((uint32_t)(ke_x256_accumulated >> MOTOR_IDENT_FILTER_COEFFICIENT) * erps) >> 8;
+	uint32_t w_x16 = erps * 101ul;
+
+	if (erps <= MOTOR_IDENT_R_MAX_ERPS)
+	{
+		// I*w*L is small at low speed, use fixed default (or configured) inductance
+		// and take the remaining voltage in phase with back-emf as I*R. Not using
+		// the identified inductance, which itself depends on R, avoids a feedback
+		// loop between the two estimates.
+		uint32_t iwl_x128 = ((uint32_t)i_x2 * motor_inductance_seed_x1048576 * w_x16) >> 18;
+		uint32_t iwl2 = iwl_x128 * iwl_x128;
+		if (iwl2 >= v2)
+		{
+			return;
+		}
+
+		uint16_t parallel_x128 = isqrt32(v2 - iwl2);
+		if (parallel_x128 <= e_x128)
+		{
+			return;
+		}
+
+		uint32_t r_x1024 = ((parallel_x128 - e_x128) << 4) / i_x2;
+		if (r_x1024 < 4096)
+		{
+			filter_motor_parameter(&r_x1024_accumulated, &r_samples, (uint16_t)r_x1024);
+		}
+	}
+	else if (erps >= MOTOR_IDENT_L_MIN_ERPS && r_samples >= MOTOR_IDENT_MIN_SAMPLES)
+	{
+		uint32_t parallel_x128 = e_x128 + (((uint32_t)i_x2 * (r_x1024_accumulated >> MOTOR_IDENT_FILTER_COEFFICIENT)) >> 4);
+		uint32_t parallel2 = parallel_x128 * parallel_x128;
+		if (parallel2 >= v2)
+		{
+			return;
+		}
+
+		uint32_t iwl_x128 = isqrt32(v2 - parallel2);
+		uint32_t l_x1048576 = (iwl_x128 << 18) / (i_x2 * w_x16);
+		if (l_x1048576 < MOTOR_INDUCTANCE_MIN_X1048576 || l_x1048576 > MOTOR_INDUCTANCE_MAX_X1048576)
+		{
+			return;
+		}
+
+		uint8_t l_filtered = (uint8_t)filter_motor_parameter(&l_x1048576_accumulated, &l_samples, (uint16_t)l_x1048576);
+		if (l_samples >= MOTOR_IDENT_L_SAMPLES && !motor_inductance_override)
+		{
+			motor_inductance_x1048576 = l_filtered;
+			save_motor_inductance();
+		}
+	}
+}
+
+static void compute_restart_duty_cycle()
+{
+	// only needed when motor is about to be enabled
+	if (control_state != CONTROL_STATE_DISABLE)
+	{
+		return;
+	}
+
+	uint16_t erps = speed_erps;
+	if (erps == 0)
+	{
+		pwm_duty_cycle_restart = 0;
+		return;
+	}
+
+	uint32_t duty;
+	if (ke_samples >= MOTOR_IDENT_MIN_SAMPLES && adc_battery_voltage_filtered > 0)
+	{
+		// Restart from duty cycle where applied phase voltage equals back-emf,
+		// giving zero current. Same units as in identify_motor_parameters().
+		uint32_t e_x128 = ((uint32_t)(ke_x256_accumulated >> MOTOR_IDENT_FILTER_COEFFICIENT) * erps) >> 8;
+		uint32_t v_x128 = ((uint32_t)adc_battery_voltage_filtered * ADC_10BIT_VOLTAGE_PER_ADC_STEP_X512) >> 2;
+		duty = (e_x128 << 8) / v_x128;
+	}
+	else
+	{
+		// back-emf constant not known, map duty cycle from erps
+		duty = MAP32(erps, 0, MAX_MOTOR_SPEED_ERPS, PWM_DUTY_CYCLE_MIN, PWM_DUTY_CYCLE_MAX);
+	}
+
+	if (duty < PWM_DUTY_CYCLE_MIN)
+	{
+		duty = PWM_DUTY_CYCLE_MIN;
+	}
+	else if (duty > PWM_DUTY_CYCLE_MAX)
+	{
+		duty = PWM_DUTY_CYCLE_MAX;
+	}
+
+	pwm_duty_cycle_restart = (uint8_t)duty;
+}
+
+static void apply_rotor_angles()
+{
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+	for (uint8_t i = 1; i <= 6; ++i)
+	{
+		rotor_angles[i] = hall_angles[i] + rotor_offset_angle;
+	}
+	TIM1->IER |= TIM1_IT_CC4;
+}
+
+static void load_rotor_calibration()
+{
+	for (uint8_t i = 1; i <= 6; ++i)
+	{
+		hall_angles[i] = g_pstate.motor_rotor_calibrated ?
+			g_pstate.motor_hall_angles[i - 1] : default_hall_angles[i];
+	}
+
+	rotor_offset_angle = g_pstate.motor_rotor_calibrated ?
+		g_pstate.motor_rotor_offset_angle : MOTOR_ROTOR_OFFSET_ANGLE;
+
+	apply_rotor_angles();
+}
+
+static bool compute_hall_angles()
+{
+	uint16_t cycles[8];
+	uint32_t total = 0;
+
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+	for (uint8_t i = 1; i <= 6; ++i)
+	{
+		cycles[i] = hall_sector_pwm_cycles[i];
+	}
+	TIM1->IER |= TIM1_IT_CC4;
+
+	for (uint8_t i = 1; i <= 6; ++i)
+	{
+		total += cycles[i];
+	}
+
+	// each sector should be close to 60 degrees, refuse obviously broken measurements
+	for (uint8_t i = 1; i <= 6; ++i)
+	{
+		uint32_t sector_x6 = cycles[i] * 6ul;
+		if (sector_x6 < total / 2 || sector_x6 > total + total / 2)
+		{
+			return false;
+		}
+	}
+
+	// measured angle of each transition relative to the first one in sequence,
+	// keep the average angle of the default table and only correct the spacing
+	uint8_t measured[6];
+	uint32_t position = 0;
+	int16_t diff = 0;
+	for (uint8_t i = 0; i < 6; ++i)
+	{
+		measured[i] = (uint8_t)((position * 256) / total);
+		diff += (int8_t)(default_hall_angles[hall_sequence[i]] - measured[i]);
+		position += cycles[hall_sequence[i]];
+	}
+
+	diff /= 6;
+	for (uint8_t i = 0; i < 6; ++i)
+	{
+		hall_angles[hall_sequence[i]] = measured[i] + (uint8_t)diff;
+	}
+
+	return true;
+}
+
+static void stop_rotor_calibration(uint8_t error)
+{
+	rotor_calibration_measure_hall = false;
+	rotor_calibration_state = ROTOR_CALIBRATION_IDLE;
+
+	control_state = CONTROL_STATE_DISABLE;
+	pwm_duty_cycle_target = 0;
+	set_battery_target_current(0);
+
+	// force targets to be reapplied on next request
+	target_speed_percent = 0;
+	target_current_percent = 0;
+
+	if (error)
+	{
+		load_rotor_calibration();
+		eventlog_write_data(EVT_ERROR_MOTOR_CALIBRATION, error);
+		return;
+	}
+
+	g_pstate.motor_rotor_calibrated = 1;
+	g_pstate.motor_rotor_offset_angle = rotor_offset_angle;
+	for (uint8_t i = 1; i <= 6; ++i)
+	{
+		g_pstate.motor_hall_angles[i - 1] = hall_angles[i];
+	}
+
+	cfgstore_save_pstate();
+
+	eventlog_write_data(EVT_DATA_MOTOR_ROTOR_OFFSET, rotor_offset_angle);
+	eventlog_write(EVT_MSG_MOTOR_CALIBRATION_DONE);
+}
+
+static void set_rotor_calibration_state(uint8_t state)
+{
+	rotor_calibration_state = state;
+	rotor_calibration_state_ms = system_ms();
+}
+
+static void process_rotor_calibration()
+{
+	if (rotor_calibration_state == ROTOR_CALIBRATION_IDLE)
+	{
+		return;
+	}
+
+	if (GET_PIN_INPUT_STATE(PIN_BRAKE) == 0)
+	{
+		stop_rotor_calibration(ROTOR_CALIBRATION_ERROR_BRAKE);
+		return;
+	}
+
+	if (is_lvc_triggered)
+	{
+		stop_rotor_calibration(ROTOR_CALIBRATION_ERROR_LVC);
+		return;
+	}
+
+	if (hall_sensor_error)
+	{
+		stop_rotor_calibration(ROTOR_CALIBRATION_ERROR_HALL_SENSOR);
+		return;
+	}
+
+	uint32_t elapsed_ms = system_ms() - rotor_calibration_state_ms;
+
+	switch (rotor_calibration_state)
+	{
+	case ROTOR_CALIBRATION_SPIN_UP:
+		if (elapsed_ms >= ROTOR_CALIBRATION_SPIN_UP_MS)
+		{
+			// motor must spin freely, otherwise current is not a measure of efficiency
+			if (speed_erps < ROTOR_CALIBRATION_MIN_ERPS)
+			{
+				stop_rotor_calibration(ROTOR_CALIBRATION_ERROR_SPEED);
+				return;
+			}
+
+			TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+			for (uint8_t i = 0; i < 8; ++i)
+			{
+				hall_sector_pwm_cycles[i] = 0;
+			}
+			rotor_calibration_measure_hall = true;
+			TIM1->IER |= TIM1_IT_CC4;
+
+			set_rotor_calibration_state(ROTOR_CALIBRATION_MEASURE_HALL);
+		}
+		break;
+	case ROTOR_CALIBRATION_MEASURE_HALL:
+		if (elapsed_ms >= ROTOR_CALIBRATION_MEASURE_HALL_MS)
+		{
+			rotor_calibration_measure_hall = false;
+
+			if (!compute_hall_angles())
+			{
+				stop_rotor_calibration(ROTOR_CALIBRATION_ERROR_HALL_SENSOR);
+				return;
+			}
+
+			rotor_calibration_sweep_steps = (2 * ROTOR_CALIBRATION_SWEEP_RANGE) / ROTOR_CALIBRATION_SWEEP_STEP;
+			rotor_calibration_best_offset = rotor_offset_angle;
+			rotor_calibration_best_current_x16 = 0xffff;
+
+			rotor_offset_angle -= ROTOR_CALIBRATION_SWEEP_RANGE;
+			apply_rotor_angles();
+
+			set_rotor_calibration_state(ROTOR_CALIBRATION_SWEEP_SETTLE);
+		}
+		break;
+	case ROTOR_CALIBRATION_SWEEP_SETTLE:
+		if (elapsed_ms >= ROTOR_CALIBRATION_SETTLE_MS)
+		{
+			rotor_calibration_current_sum = 0;
+			rotor_calibration_current_samples = 0;
+
+			set_rotor_calibration_state(ROTOR_CALIBRATION_SWEEP_MEASURE);
+		}
+		break;
+	case ROTOR_CALIBRATION_SWEEP_MEASURE:
+		rotor_calibration_current_sum += adc_battery_current_filtered;
+		rotor_calibration_current_samples++;
+
+		if (elapsed_ms >= ROTOR_CALIBRATION_MEASURE_MS)
+		{
+			uint16_t current_x16 = (uint16_t)((rotor_calibration_current_sum * 16) / rotor_calibration_current_samples);
+			if (current_x16 < rotor_calibration_best_current_x16)
+			{
+				rotor_calibration_best_current_x16 = current_x16;
+				rotor_calibration_best_offset = rotor_offset_angle;
+			}
+
+			if (rotor_calibration_sweep_steps == 0)
+			{
+				rotor_offset_angle = rotor_calibration_best_offset;
+				apply_rotor_angles();
+
+				stop_rotor_calibration(0);
+				return;
+			}
+
+			rotor_calibration_sweep_steps--;
+			rotor_offset_angle += ROTOR_CALIBRATION_SWEEP_STEP;
+			apply_rotor_angles();
+
+			set_rotor_calibration_state(ROTOR_CALIBRATION_SWEEP_SETTLE);
+		}
+		break;
+	}
+}
+
+
+static void set_pwm_frequency(uint8_t frequency)
+{
+	if (frequency > PWM_FREQUENCY_23_4KHZ)
+	{
+		frequency = PWM_FREQUENCY_15_6KHZ;
+	}
+
+	uint16_t auto_reload_period = pwm_auto_reload_periods[frequency];
+	uint16_t period_ticks = 2 * auto_reload_period;
+	uint16_t cycles_second = (uint16_t)(TIM1_CLOCK_HZ / period_ticks);
+
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+
+	pwm_frequency = frequency;
+	pwm_period_ticks = period_ticks;
+	pwm_cc4_compare = (uint16_t)(((uint32_t)TIM1_CC4_COMPARE * auto_reload_period) / TIM1_AUTO_RELOAD_PERIOD);
+	pwm_center_ticks = (auto_reload_period + 1) / 2;
+	pwm_max_compare_ticks = auto_reload_period;
+	pwm_output_scale = pwm_center_ticks < 256 ? (uint8_t)pwm_center_ticks : 0;
+	svm_duty_table_active = SVM_DUTY_TABLE_NONE;
+	pwm_ticks_x16_scale = (uint8_t)((16384U + period_ticks / 2) / period_ticks);
+
+	pwm_cycles_second = cycles_second;
+	pwm_cycles_counter_max = cycles_second / PWM_CYCLES_COUNTER_MIN_ERPS;
+	observer_start_erev_pwm_cycles = cycles_second / MOTOR_ROTOR_ERPS_START_OBSERVER;
+	speed_controller_check_periods = (uint16_t)(((uint32_t)cycles_second * SPEED_CONTROLLER_CHECK_PERIOD_MS) / 1000);
+	current_controller_check_periods = (uint8_t)(((uint32_t)cycles_second * CURRENT_CONTROLLER_CHECK_PERIOD_US) / 1000000);
+
+	// cycles_second * 0.15625 / 4
+	adc_current_ramp_up_inverse_step = (uint16_t)(((uint32_t)cycles_second * 5) / 128) / current_ramp_amps_s;
+	adc_current_ramp_up_fast_inverse_step = (uint16_t)(((uint32_t)cycles_second * 5) / 128) /
+		(current_ramp_amps_s > CURRENT_RAMP_UP_FAST_AMPS_S ? current_ramp_amps_s : CURRENT_RAMP_UP_FAST_AMPS_S);
+
+	timer1_set_motor_pwm_period(auto_reload_period);
+	pwm_isr_max_ticks = 0;
+
+	TIM1->IER |= TIM1_IT_CC4;
+}
+
+static uint8_t read_pwm_isr_load_percent()
 {
-	// low pass filter the positive battery readed value (no regen current), to avoid possible fast spikes/noise
-	adc_battery_current_accumulated -= adc_battery_current_accumulated >> BATTERY_CURRENT_FILTER_COEFFICIENT;
-	adc_battery_current_accumulated += adc_battery_current;
-	adc_battery_current_filtered = adc_battery_current_accumulated >> BATTERY_CURRENT_FILTER_COEFFICIENT;
+	// max execution time since last read
+	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
+	uint16_t max_ticks = pwm_isr_max_ticks;
+	pwm_isr_max_ticks = 0;
+	TIM1->IER |= TIM1_IT_CC4;
+
+	uint32_t load_percent = ((uint32_t)max_ticks * 100) / pwm_period_ticks;
+	return load_percent > 255 ? 255 : (uint8_t)load_percent;
 }
 
-static void read_phase_current()
+static void reject_pwm_frequency(uint8_t load_percent)
 {
-	// low pass filter the positive motor pahse value (no regen current), to avoid possible fast spikes/noise
-	adc_phase_current_accumulated -= adc_phase_current_accumulated >> PHASE_CURRENT_FILTER_COEFFICIENT;
-	adc_phase_current_accumulated += adc_phase_current;
-	adc_phase_current_filtered = adc_phase_current_accumulated >> PHASE_CURRENT_FILTER_COEFFICIENT;
+	set_pwm_frequency(PWM_FREQUENCY_15_6KHZ);
+	eventlog_write_data(EVT_ERROR_MOTOR_PWM_FREQUENCY, load_percent);
+
+	if (g_config.motor_pwm_frequency != PWM_FREQUENCY_15_6KHZ)
+	{
+		g_config.motor_pwm_frequency = PWM_FREQUENCY_15_6KHZ;
+		cfgstore_save_config();
+	}
 }
 
-static uint8_t asin_table(uint8_t inverted_angle_x128)
+static void validate_pwm_frequency()
 {
-	// calc asin also converts the final result to degrees
-	uint8_t index = 0;
-	while (index < SIN_TABLE_LEN)
+	if (pwm_frequency == PWM_FREQUENCY_15_6KHZ)
 	{
-		if (inverted_angle_x128 < sin_table[index])
-		{
-			break;
-		}
-
-		index++;
+		return;
 	}
 
-	// first value of table is 0 so index will always increment to at least 1 and return 0
-	return index--;
+	// motor is disabled, measure interrupt load before it can be enabled
+	read_pwm_isr_load_percent();
+	system_delay_ms(PWM_ISR_LOAD_TEST_MS);
+
+	uint8_t load_percent = read_pwm_isr_load_percent();
+	if (load_percent > PWM_ISR_TEST_MAX_LOAD_PERCENT)
+	{
+		reject_pwm_frequency(load_percent);
+	}
 }
 
-static void compute_foc_angle()
+static void check_pwm_isr_load()
 {
-	uint16_t ui16_temp;
-	uint32_t ui32_temp;
-	uint16_t e_phase_voltage;
-	uint32_t i_phase_current_x2;
-	uint32_t l_x1048576;
-	uint32_t w_angular_velocity_x16;
-	uint16_t iwl_128;
+	static uint32_t last_check_ms = 0;
+	static uint8_t overload_percent = 0;
 
-	// FOC implementation by calculating the angle between phase current and rotor magnetic flux (BEMF)
-	// 1. phase voltage is calculate
-	// 2. I*w*L is calculated, where I is the phase current. L was a measured value for 48V motor.
-	// 3. inverse sin is calculated of (I*w*L) / phase voltage, were we obtain the angle
-	// 4. previous calculated angle is applied to phase voltage vector angle and so the
-	// angle between phase current and rotor magnetic flux (BEMF) is kept at 0 (max torque per amp)
+	uint32_t now = system_ms();
+	if (now - last_check_ms < PWM_ISR_LOAD_CHECK_INTERVAL_MS)
+	{
+		return;
+	}
 
-	// calc E phase voltage
-	ui16_temp = adc_battery_voltage_filtered * ADC_10BIT_VOLTAGE_PER_ADC_STEP_X512;
-	ui16_temp = (ui16_temp >> 8) * pwm_duty_cycle;
-	e_phase_voltage = ui16_temp >> 9;
+	last_check_ms = now;
 
-	// calc I phase current
-	if (pwm_duty_cycle > 10)
+	uint8_t load_percent = read_pwm_isr_load_percent();
+	if (pwm_frequency == PWM_FREQUENCY_15_6KHZ)
 	{
-		ui16_temp = ((uint16_t)adc_battery_current_filtered) * ADC_10BIT_CURRENT_PER_ADC_STEP_X512;
-		i_phase_current_x2 = ui16_temp / pwm_duty_cycle;
+		return;
 	}
-	else
+
+	if (load_percent > PWM_ISR_MAX_LOAD_PERCENT && load_percent > overload_percent)
 	{
-		i_phase_current_x2 = 0;
+		overload_percent = load_percent;
 	}
 
-	// calc W angular velocity: erps * 6.3
-	// 101 = 6.3 * 16
-	TIM1->IER &= ~(uint8_t)TIM1_IT_CC4;
-	ui16_temp = speed_erps;
-	TIM1->IER |= TIM1_IT_CC4;
-	w_angular_velocity_x16 = ui16_temp * 101;
-
-	// ---------------------------------------------------------------------------------------------------------------------
-	// 36 V motor: L = 76uH
-	// 48 V motor: L = 135uH
-	// ui32_l_x1048576 = 142; // 1048576 = 2^20 | 48V
-	// ui32_l_x1048576 = 84; // 1048576 = 2^20 | 36V
-	//
-	// ui32_l_x1048576 = 142 <--- THIS VALUE WAS verified experimentaly on 2018.07 to be near the best value for a 48V motor
-	// Test done with a fixed mechanical load, duty_cycle = 200 and 100 and measured battery current was 16 and 6 (10 and 4 amps)
-	// ---------------------------------------------------------------------------------------------------------------------
-
-#if 0
-	l_x1048576 = 84; // 36 V motor
-#else
-	l_x1048576 = 142; // 48 V motor
-#endif
-
-	// calc IwL
-	ui32_temp = i_phase_current_x2 * l_x1048576;
-	ui32_temp *= w_angular_velocity_x16;
-	iwl_128 = ui32_temp >> 18;
-
-	// calc FOC angle
-	uint8_t foc_angle_unfiltered = asin_table(iwl_128 / e_phase_voltage);
-
-	// low pass filter FOC angle
-	foc_angle_accumulated -= foc_angle_accumulated >> 4;
-	foc_angle_accumulated += foc_angle_unfiltered;
-	foc_angle = foc_angle_accumulated >> 4;
+	// frequency is not changed while motor is running
+	if (overload_percent > 0 && control_state == CONTROL_STATE_DISABLE)
+	{
+		reject_pwm_frequency(overload_percent);
+		overload_percent = 0;
+	}
 }
 
+static uint8_t read_hall_sensors_state()
+{
+	// read hall sensors signal pins and mask other pins
+	// hall sensors sequence with motor forward rotation: 4, 6, 2, 3, 1, 5
+	return
+		((GET_PORT(PIN_HALL_SENSOR_A)->IDR & GET_PIN(PIN_HALL_SENSOR_A)) >> 5) |
+		((GET_PORT(PIN_HALL_SENSOR_B)->IDR & GET_PIN(PIN_HALL_SENSOR_B)) >> 1) |
+		((GET_PORT(PIN_HALL_SENSOR_C)->IDR & GET_PIN(PIN_HALL_SENSOR_C)) >> 3);
+}
 
 void motor_pre_init()
 {
@@ -349,6 +1389,30 @@ void motor_pre_init()
 	SET_PIN_INPUT(PIN_HALL_SENSOR_B);
 	SET_PIN_INPUT(PIN_HALL_SENSOR_C);
 
+	// Interrupt on both edges of hall sensor pins, sensitivity and priority
+	// can only be configured while interrupts are disabled (before system_init).
+	// Hall sensor interrupts are kept at priority level 3 and all other interrupts
+	// are lowered to level 2 so only hall sensor interrupts can preempt the
+	// pwm interrupt, timestamps are then not delayed by it.
+	EXTI->CR1 |= (uint8_t)(EXTI_SENSITIVITY_RISE_FALL << 4);	// port C
+	EXTI->CR1 |= (uint8_t)(EXTI_SENSITIVITY_RISE_FALL << 6);	// port D
+	EXTI->CR2 |= (uint8_t)(EXTI_SENSITIVITY_RISE_FALL << 0);	// port E
+
+	ITC->ISPR1 = 0x00;
+	ITC->ISPR2 = 0xfc;	// port C, D, E at level 3
+	ITC->ISPR3 = 0x00;
+	ITC->ISPR4 = 0x00;
+	ITC->ISPR5 = 0x00;
+	ITC->ISPR6 = 0x00;
+	ITC->ISPR7 = 0x00;
+	ITC->ISPR8 = 0x00;
+
+	hall_edge_state = read_hall_sensors_state();
+
+	GET_PORT(PIN_HALL_SENSOR_A)->CR2 |= GET_PIN(PIN_HALL_SENSOR_A);
+	GET_PORT(PIN_HALL_SENSOR_B)->CR2 |= GET_PIN(PIN_HALL_SENSOR_B);
+	GET_PORT(PIN_HALL_SENSOR_C)->CR2 |= GET_PIN(PIN_HALL_SENSOR_C);
+
 	SET_PIN_LOW(PIN_PWM_PHASE_A_LOW);
 	SET_PIN_LOW(PIN_PWM_PHASE_A_HIGH);
 	SET_PIN_LOW(PIN_PWM_PHASE_B_LOW);
@@ -373,8 +1437,8 @@ void motor_init(uint16_t max_current_mA, uint8_t lvc_V, int16_t adc_calib_volt_s
 	adc_steps_per_volt_x512 = ADC_10BIT_STEPS_PER_VOLT_X512 + adc_calib_volt_step_offset;
 
 	// compute hard current limits (not changed after here)
-	adc_battery_max_current = (uint8_t)(
-		((((uint32_t)MIN(max_current_x10A, MAX_BATTERY_CURRENT_AMPS_X10)) * 512) / 10) / ADC_10BIT_CURRENT_PER_ADC_STEP_X512
+	adc_battery_max_current_x4 = (uint16_t)(
+		((((uint32_t)MIN(max_current_x10A, MAX_BATTERY_CURRENT_AMPS_X10)) * 512 * BATTERY_CURRENT_OVERSAMPLING) / 10) / ADC_10BIT_CURRENT_PER_ADC_STEP_X512
 	);
 
 	adc_phase_max_current = (uint8_t)(
@@ -383,22 +1447,47 @@ void motor_init(uint16_t max_current_mA, uint8_t lvc_V, int16_t adc_calib_volt_s
 
 	adc_low_voltage_limit = (uint16_t)((((uint32_t)lvc_V) * adc_steps_per_volt_x512) / 512);
 
+	if (g_config.current_ramp_amps_s > 0)
+	{
+		current_ramp_amps_s = g_config.current_ramp_amps_s;
+	}
+
+	load_motor_inductance();
+	load_motor_ke();
+
 	flash_opt2_afr5();
 	timer1_init_motor_pwm();
+	set_pwm_frequency(g_config.motor_pwm_frequency);
+	load_rotor_calibration();
 	motor_disable();
+	validate_pwm_frequency();
 }
 
 void motor_process()
 {
+	read_motor_speed();
 	read_battery_voltage();
 	read_battery_current();
 	read_phase_current();
+	compute_duty_cycle_ramp_steps();
+	update_svm_duty_table();
+	report_svm_duty_table_hit_rate();
 	compute_foc_angle();
+	identify_motor_parameters();
+	save_pstate_if_idle();
+	compute_restart_duty_cycle();
+	process_rotor_calibration();
+	check_pwm_isr_load();
 }
 
 
 void motor_enable()
 {
+	if (rotor_calibration_state != ROTOR_CALIBRATION_IDLE)
+	{
+		return;
+	}
+
 	if (control_state == CONTROL_STATE_DISABLE)
 	{
 		control_state = CONTROL_STATE_PREPARE;
@@ -407,6 +1496,11 @@ void motor_enable()
 
 void motor_disable()
 {
+	if (rotor_calibration_state != ROTOR_CALIBRATION_IDLE)
+	{
+		return;
+	}
+
 	control_state = CONTROL_STATE_DISABLE;
 }
 
@@ -440,9 +1534,18 @@ uint8_t motor_get_target_current()
 	return target_current_percent;
 }
 
+void motor_set_fast_current_ramp(bool enable)
+{
+	current_ramp_fast = enable;
+}
 
 void motor_set_target_speed(uint8_t percent)
 {
+	if (rotor_calibration_state != ROTOR_CALIBRATION_IDLE)
+	{
+		return;
+	}
+
 	if (percent > 100)
 	{
 		percent = 100;
@@ -466,6 +1569,11 @@ void motor_set_target_speed(uint8_t percent)
 
 void motor_set_target_current(uint8_t percent)
 {
+	if (rotor_calibration_state != ROTOR_CALIBRATION_IDLE)
+	{
+		return;
+	}
+
 	if (percent > 100)
 	{
 		percent = 100;
@@ -476,7 +1584,7 @@ void motor_set_target_current(uint8_t percent)
 		target_current_percent = percent;
 		eventlog_write_data(EVT_DATA_TARGET_CURRENT, percent);
 
-		adc_battery_target_current = ((uint16_t)percent * adc_battery_max_current) / 100;
+		set_battery_target_current((uint16_t)(((uint32_t)percent * adc_battery_max_current_x4) / 100));
 	}
 }
 
@@ -502,6 +1610,35 @@ int16_t motor_calibrate_battery_voltage(uint16_t actual_voltage_x100)
 	return diff;
 }
 
+bool motor_start_calibration()
+{
+	// only allowed when motor is not in use
+	if (control_state != CONTROL_STATE_DISABLE || rotor_calibration_state != ROTOR_CALIBRATION_IDLE)
+	{
+		return false;
+	}
+
+	eventlog_write(EVT_MSG_MOTOR_CALIBRATION_BEGIN);
+
+	// start from current calibration
+	load_rotor_calibration();
+
+	pwm_duty_cycle_target = ROTOR_CALIBRATION_PWM_DUTY_CYCLE;
+	uint16_t current_x4 = (uint16_t)(
+		((ROTOR_CALIBRATION_MAX_CURRENT_AMPS_X10 * 512ul * BATTERY_CURRENT_OVERSAMPLING) / 10) / ADC_10BIT_CURRENT_PER_ADC_STEP_X512
+	);
+	if (current_x4 > adc_battery_max_current_x4)
+	{
+		current_x4 = adc_battery_max_current_x4;
+	}
+	set_battery_target_current(current_x4);
+
+	set_rotor_calibration_state(ROTOR_CALIBRATION_SPIN_UP);
+	control_state = CONTROL_STATE_PREPARE;
+
+	return true;
+}
+
 
 uint16_t motor_get_battery_lvc_x10()
 {
@@ -510,7 +1647,7 @@ uint16_t motor_get_battery_lvc_x10()
 
 uint16_t motor_get_battery_current_x10()
 {
-	return (uint16_t)((((uint32_t)adc_battery_current_filtered * 10) * ADC_10BIT_CURRENT_PER_ADC_STEP_X512) >> 9);
+	return (uint16_t)((((uint32_t)adc_battery_current_filtered_x4 * 10) * ADC_10BIT_CURRENT_PER_ADC_STEP_X512) >> 11);
 }
 
 uint16_t motor_get_battery_voltage_x10()
@@ -518,11 +1655,20 @@ uint16_t motor_get_battery_voltage_x10()
 	return (uint16_t)(((uint32_t)adc_battery_voltage_filtered * 5120) / adc_steps_per_volt_x512);
 }
 
+uint8_t motor_get_duty_cycle_percent()
+{
+	return (uint8_t)(((uint16_t)pwm_duty_cycle * 100) / 255);
+}
+
 
 // state variables only used by isr
 // ---------------------------------------------
 static uint8_t hall_sensors_state_last = 0;
-static uint8_t rotor_absolute_angle = 0;
+static uint16_t rotor_angle_x256 = 0;
+static uint16_t rotor_angle_delta_x256 = 0;
+static int16_t rotor_angle_integral_x256 = 0;
+static uint16_t rotor_angle_advance_x256 = 0;
+static uint16_t rotor_angle_max_advance_x256 = 0;
 static uint8_t half_erps_flag = 0;
 static uint8_t commutation_type = BLOCK_COMMUTATION;
 
@@ -531,25 +1677,64 @@ static uint16_t pwm_duty_cycle_ramp_down_counter = 0;
 
 static uint16_t pwm_cycles_counter = 1;
 static uint16_t pwm_cycles_counter_6 = 1;
-static uint16_t pwm_cycles_counter_total = 0xffff;
+
+static uint16_t pwm_cycle_number = 0;
+static uint8_t hall_edge_sequence_last = 0;
+
+// battery current samples of last pwm cycles, only accessed by pwm interrupt
+static uint16_t adc_current_samples[BATTERY_CURRENT_OVERSAMPLING];
+static uint16_t adc_current_sample = 0;
+static uint16_t adc_current_moving_sum_x4 = 0;
+static uint8_t adc_current_sample_index = 0;
+static uint8_t adc_current_missed_samples = 0;
+static uint16_t hall_edge_last_pwm_cycle = 0;
+static uint16_t hall_edge_last_ticks = 0;
+static bool hall_edge_last_valid = false;
+static uint16_t hall_erev_start_pwm_cycle = 0;
+static uint16_t hall_erev_start_ticks = 0;
+static bool hall_erev_start_valid = false;
 
 static uint16_t adc_current_ramp_up_counter = 0;
 static uint8_t current_controller_counter = 0;
 static uint16_t speed_controller_counter = 0;
 
-static uint8_t adc_battery_ramp_max_current = 0;
+static uint16_t adc_battery_ramp_max_current_x4 = 0;
 
 // Measures did with a 24V Q85 328 RPM motor, rotating motor backwards by hand:
 // Hall sensor A positive to negative transition | BEMF phase B at max value / top of sinewave
 // Hall sensor B positive to negative transition | BEMF phase A at max value / top of sinewave
 // Hall sensor C positive to negative transition | BEMF phase C at max value / top of sinewave
 
-// runs every 64us (PWM frequency)
+// runs every 64us (PWM frequency), priority level 2, only hall sensor interrupts can preempt
 // Measured on 2022-12-04, the interrupt code takes about 45% of the total 64us
+// Timer1 ticks since cc4 event of the current pwm cycle, called from both
+// the pwm interrupt and the hall sensor interrupts.
+static uint16_t read_pwm_cycle_ticks()
+{
+	// read direction before counter, position is continuous over the bottom turning point
+	// since it is wrapped at the cc4 position
+	uint8_t down = TIM1->CR1 & TIM1_CR1_DIR;
+	uint16_t counter = (uint16_t)TIM1->CNTRH << 8;
+	counter |= TIM1->CNTRL;
+
+	uint16_t ticks = down ? (pwm_period_ticks - counter) : counter;
+	ticks += pwm_cc4_compare;
+	if (ticks >= pwm_period_ticks)
+	{
+		ticks -= pwm_period_ticks;
+	}
+
+	return ticks;
+}
+
 void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 {
-	// read battery current adc value, should happen at middle of the pwm duty cycle
-	// no scan, align data right since we are only interested in the 8 lsb.
+	// timebase for hall sensor timestamps, must be first
+	pwm_cycle = (uint8_t)++pwm_cycle_number;
+
+	// start battery current adc conversion, should happen at middle of the pwm duty cycle
+	// no scan, align data right, full 10bit value is used.
+	// Result is read below, conversion (14 adc clocks) completes in the meantime.
 	ADC1->CR2 = (ADC1_ALIGN_RIGHT);
 
 	// disable eoc interrupt, clear EOC flag and select channel 5 (current sense)
@@ -557,16 +1742,6 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 
 	// perform single mode ADC1 conversion
 	ADC1->CR1 |= ADC1_CR1_ADON;
-	while (!(ADC1->CSR & ADC1_CSR_EOC));
-
-	// adc current reading is truncated to 8bit since that allows a 
-	// range of up to 40A which it is not expected to be surpassed.
-	// check of 8bit overflow and save result, flag is used to limit
-	// current in isr if overflow for some reason would occur.
-	uint8_t adc_battery_current_ovf = ADC1->DRH;
-
-	// atomic write (uint8), current is not expected to exceed adc 255 (40A)
-	adc_battery_current = ADC1->DRL;
 
 	switch (control_state)
 	{
@@ -579,12 +1754,9 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 	case CONTROL_STATE_PREPARE:
 		if (speed_erps > 0)
 		{
-			// Restart from duty cycle mapped from erps.
-			// This is probably not the correct way to do this, but
-			// it seems to work reasonably well. VESC tracks back-emf
-			// to calculate duty cyle to restart from...
-			pwm_duty_cycle = (uint8_t)MAP32(speed_erps, 0, MAX_MOTOR_SPEED_ERPS, PWM_DUTY_CYCLE_MIN, PWM_DUTY_CYCLE_MAX);
-		}	
+			// restart from duty cycle tracking back-emf, see compute_restart_duty_cycle()
+			pwm_duty_cycle = pwm_duty_cycle_restart;
+		}
 		control_state = CONTROL_STATE_START;
 		break;
 	case CONTROL_STATE_START:
@@ -598,11 +1770,66 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 		break;
 	}
 
+	// read hall sensor signals latched by external interrupt
+	// find the motor rotor absolute angle
+	// measure electrical revolution period (speed_erps is calculated in main loop)
+	uint8_t hall_sensors_state;
+	uint8_t edge_pwm_cycle;
+	uint16_t edge_ticks;
+	uint8_t sequence;
+	do
+	{
+		sequence = hall_edge_sequence;
+		hall_sensors_state = hall_edge_state;
+		edge_pwm_cycle = hall_edge_pwm_cycle;
+		edge_ticks = hall_edge_ticks;
+	} while (sequence != hall_edge_sequence);
+
+	// read battery current, conversion is normally complete here,
+	// wait a bounded time if not, previous sample is used on timeout
+	uint8_t eoc_wait = ADC_CURRENT_EOC_MAX_WAIT;
+	while (!(ADC1->CSR & ADC1_CSR_EOC) && eoc_wait)
+	{
+		--eoc_wait;
+	}
+
+	bool adc_current_valid = (ADC1->CSR & ADC1_CSR_EOC) != 0;
+	if (adc_current_valid)
+	{
+		// right aligned, lsb must be read first
+		uint8_t low = ADC1->DRL;
+		adc_current_sample = ((uint16_t)ADC1->DRH << 8) | low;
+		adc_current_missed_samples = 0;
+	}
+	else if (adc_current_missed_samples < ADC_CURRENT_MAX_MISSED_SAMPLES)
+	{
+		++adc_current_missed_samples;
+	}
+
+	// moving sum of samples from last 4 pwm cycles (x4)
+	adc_current_moving_sum_x4 -= adc_current_samples[adc_current_sample_index];
+	adc_current_moving_sum_x4 += adc_current_sample;
+	adc_current_samples[adc_current_sample_index] = adc_current_sample;
+	adc_current_sample_index = (adc_current_sample_index + 1) & (BATTERY_CURRENT_OVERSAMPLING - 1);
+
+	uint16_t adc_current_x4 = adc_current_moving_sum_x4;
+
+	// not atomic, main loop reads with interrupt disabled
+	adc_battery_current_x4 = adc_current_x4;
+
 	// calculate motor current adc value
+	uint16_t adc_current = adc_current_x4 / BATTERY_CURRENT_OVERSAMPLING;
 	if (pwm_duty_cycle > 0)
 	{
-		// atomic write (uint8), current is not expected to exceed adc 255 (40A)
-		adc_phase_current = (uint8_t)((adc_battery_current * 256u) / pwm_duty_cycle);
+		// atomic write (uint8), saturated at adc 255 (40A)
+		if (adc_current < pwm_duty_cycle)
+		{
+			adc_phase_current = (uint8_t)((adc_current * 256u) / pwm_duty_cycle);
+		}
+		else
+		{
+			adc_phase_current = 255;
+		}
 	}
 	else
 	{
@@ -611,97 +1838,91 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 
 	// trigger adc conversion of all channels (scan conversion, buffered)
 	// adc scan mode conversion will finish before
-	// this motor control interrupt will be run next time
+	// this motor control interrupt will be run next time,
+	// skipped if battery current conversion is still running
 	// 
-	// enable scan, align left
-	ADC1->CR2 = (ADC1_ALIGN_LEFT | ADC1_CR2_SCAN);
-
-	// clear EOC flag, enable eoc interrupt, scan read all channel 0-7
-	ADC1->CSR = (ADC1_CSR_EOCIE | 0x07);
-
-	// start adc scan mode conversion
-	ADC1->CR1 |= ADC1_CR1_ADON;
+	if (adc_current_valid)
+	{
+		// enable scan, align left
+		ADC1->CR2 = (ADC1_ALIGN_LEFT | ADC1_CR2_SCAN);
 
+		// clear EOC flag, enable eoc interrupt, scan read all channel 0-7
+		ADC1->CSR = (ADC1_CSR_EOCIE | 0x07);
 
-	// read hall sensor signals
-	// find the motor rotor absolute angle
-	// calc motor speed in erps (speed_erps)
+		// start adc scan mode conversion
+		ADC1->CR1 |= ADC1_CR1_ADON;
+	}
 
-	// read hall sensors signal pins and mask other pins
-	// hall sensors sequence with motor forward rotation: 4, 6, 2, 3, 1, 5
-	uint8_t hall_sensors_state = 
-		((GET_PORT(PIN_HALL_SENSOR_A)->IDR & GET_PIN(PIN_HALL_SENSOR_A)) >> 5) |
-		((GET_PORT(PIN_HALL_SENSOR_B)->IDR & GET_PIN(PIN_HALL_SENSOR_B)) >> 1) |
-		((GET_PORT(PIN_HALL_SENSOR_C)->IDR & GET_PIN(PIN_HALL_SENSOR_C)) >> 3);
 
 	// make sure we run next code only when there is a change on the hall sensors signal
 	if (hall_sensors_state != hall_sensors_state_last)
 	{
+		if (rotor_calibration_measure_hall)
+		{
+			// counter is one ahead of the number of pwm cycles spent in last sector
+			hall_sector_pwm_cycles[hall_sensors_state_last & 0x07] += pwm_cycles_counter_6 - 1;
+		}
+
 		hall_sensors_state_last = hall_sensors_state;
 
-		switch (hall_sensors_state)
+		// timestamp is not valid when hall sensor code execution was forced at near zero speed
+		bool edge_timestamp_valid = sequence != hall_edge_sequence_last;
+		hall_edge_sequence_last = sequence;
+
+		// edge happened at most a few pwm cycles ago, extend 8bit cycle number
+		uint16_t edge_pwm_cycle_number = pwm_cycle_number - (uint8_t)((uint8_t)pwm_cycle_number - edge_pwm_cycle);
+		if (!edge_timestamp_valid)
 		{
-		case 3:
-			rotor_absolute_angle = (uint8_t)MOTOR_ROTOR_ANGLE_150;
-			break;
+			edge_pwm_cycle_number = pwm_cycle_number;
+			edge_ticks = 0;
+		}
 
+		switch (hall_sensors_state)
+		{
 		case 1:
 			if (half_erps_flag == 1)
 			{
 				half_erps_flag = 0;
-				pwm_cycles_counter_total = pwm_cycles_counter;
 				pwm_cycles_counter = 1;
 
-				if (pwm_cycles_counter_total > 0)
-				{
-					// This division takes 4.4us
-					speed_erps = PWM_CYCLES_SECOND / pwm_cycles_counter_total;
-				}
-				else
+				if (hall_erev_start_valid && edge_timestamp_valid)
 				{
-					speed_erps = PWM_CYCLES_SECOND;
-				}
+					uint16_t erev_pwm_cycles = edge_pwm_cycle_number - hall_erev_start_pwm_cycle;
+					hall_erev_pwm_cycles = erev_pwm_cycles;
+					hall_erev_ticks = (int16_t)edge_ticks - (int16_t)hall_erev_start_ticks;
 
-				// update motor commutation state based on motor speed
-				if (speed_erps > MOTOR_ROTOR_ERPS_START_INTERPOLATION_60_DEGREES)
-				{
-					if (commutation_type == BLOCK_COMMUTATION)
+					// update motor commutation state based on motor speed
+					if (erev_pwm_cycles < observer_start_erev_pwm_cycles)
 					{
-						commutation_type = SINEWAVE_INTERPOLATION_60_DEGREES;
+						if (commutation_type == BLOCK_COMMUTATION)
+						{
+							commutation_type = SINEWAVE_OBSERVER;
+						}
 					}
-				}
-				else
-				{
-					if (commutation_type == SINEWAVE_INTERPOLATION_60_DEGREES)
+					else
 					{
-						commutation_type = BLOCK_COMMUTATION;
-						foc_angle = 0;
+						if (commutation_type == SINEWAVE_OBSERVER)
+						{
+							commutation_type = BLOCK_COMMUTATION;
+							foc_angle = 0;
+						}
 					}
 				}
 			}
 
-			rotor_absolute_angle = (uint8_t)MOTOR_ROTOR_ANGLE_210;
-			break;
-
-		case 5:
-			rotor_absolute_angle = (uint8_t)MOTOR_ROTOR_ANGLE_270;
-			break;
-
-		case 4:
-			rotor_absolute_angle = (uint8_t)MOTOR_ROTOR_ANGLE_330;
+			hall_erev_start_pwm_cycle = edge_pwm_cycle_number;
+			hall_erev_start_ticks = edge_ticks;
+			hall_erev_start_valid = edge_timestamp_valid;
 			break;
 
 		case 6:
 			half_erps_flag = 1;
-
-			rotor_absolute_angle = (uint8_t)MOTOR_ROTOR_ANGLE_30;
 			break;
 
-			// BEMF is always 90 degrees advanced over motor rotor position degree zero
-			// and here (hall sensor C blue wire, signal transition from positive to negative),
-			// phase B BEMF is at max value (measured on osciloscope by rotating the motor)
 		case 2:
-			rotor_absolute_angle = (uint8_t)MOTOR_ROTOR_ANGLE_90;
+		case 3:
+		case 4:
+		case 5:
 			break;
 
 		default:
@@ -710,12 +1931,110 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 			return;
 		}
 
+		// time from edge until now in 1/16 pwm cycles
+		int16_t edge_elapsed_x16 = (int16_t)((pwm_cycle_number - edge_pwm_cycle_number) << 4) - (int16_t)PWM_TICKS_X16(edge_ticks);
+		if (edge_elapsed_x16 < 0)
+		{
+			edge_elapsed_x16 = 0;
+		}
+		else if (edge_elapsed_x16 > 32)
+		{
+			edge_elapsed_x16 = 32;
+		}
+
+		// sector period in 1/16 pwm cycles
+		uint16_t sector_x16;
+		if (hall_edge_last_valid && (uint16_t)(edge_pwm_cycle_number - hall_edge_last_pwm_cycle) < 255)
+		{
+			sector_x16 = ((edge_pwm_cycle_number - hall_edge_last_pwm_cycle) << 4) +
+				PWM_TICKS_X16(edge_ticks) - PWM_TICKS_X16(hall_edge_last_ticks);
+		}
+		else if (pwm_cycles_counter_6 < 255)
+		{
+			// pwm_cycles_counter_6 is one ahead of the number of pwm cycles spent in last sector
+			sector_x16 = (pwm_cycles_counter_6 - 1) << 4;
+		}
+		else
+		{
+			sector_x16 = HALL_SECTOR_PERIOD_X16_MAX;
+		}
+
+		if (sector_x16 < HALL_SECTOR_PERIOD_X16_MIN)
+		{
+			sector_x16 = HALL_SECTOR_PERIOD_X16_MIN;
+		}
+		else if (sector_x16 > HALL_SECTOR_PERIOD_X16_MAX)
+		{
+			sector_x16 = HALL_SECTOR_PERIOD_X16_MAX;
+		}
+
+		hall_edge_last_pwm_cycle = edge_pwm_cycle_number;
+		hall_edge_last_ticks = edge_ticks;
+		hall_edge_last_valid = edge_timestamp_valid;
+
+		// BEMF is always 90 degrees advanced over motor rotor position degree zero
+		// and at state 2 (hall sensor C blue wire, signal transition from positive to negative),
+		// phase B BEMF is at max value (measured on osciloscope by rotating the motor)
+		uint8_t hall_angle = rotor_angles[hall_sensors_state];
+
+		// rotor has moved since the edge, estimated from current observer speed
+		uint16_t edge_advance_x256 = 0;
+		if (commutation_type == SINEWAVE_OBSERVER)
+		{
+			edge_advance_x256 = (rotor_angle_delta_x256 >> 4) * (uint16_t)edge_elapsed_x16;
+		}
+
+		// correct rotor angle observer
+		int16_t angle_error_x256 = (int16_t)((((uint16_t)hall_angle << 8) + edge_advance_x256) - rotor_angle_x256);
+		if (commutation_type == BLOCK_COMMUTATION ||
+			angle_error_x256 > ROTOR_OBSERVER_MAX_ERROR_X256 ||
+			angle_error_x256 < -ROTOR_OBSERVER_MAX_ERROR_X256)
+		{
+			// not tracking, synchronize to hall sensor
+			rotor_angle_x256 = ((uint16_t)hall_angle << 8) + edge_advance_x256;
+			rotor_angle_integral_x256 = 0;
+			angle_error_x256 = 0;
+		}
+		else
+		{
+			rotor_angle_integral_x256 += angle_error_x256 >> ROTOR_OBSERVER_KI_SHIFT;
+			if (rotor_angle_integral_x256 > ROTOR_OBSERVER_MAX_INTEGRAL_X256)
+			{
+				rotor_angle_integral_x256 = ROTOR_OBSERVER_MAX_INTEGRAL_X256;
+			}
+			else if (rotor_angle_integral_x256 < -ROTOR_OBSERVER_MAX_INTEGRAL_X256)
+			{
+				rotor_angle_integral_x256 = -ROTOR_OBSERVER_MAX_INTEGRAL_X256;
+			}
+
+			int16_t correction_x256 = angle_error_x256 >> 1;
+			rotor_angle_x256 += correction_x256;
+			angle_error_x256 -= correction_x256;
+		}
+
+		// distance to next transition from edge, remaining error and integral
+		// are added to the speed for the next sector
+		uint8_t sector_angle = rotor_angles[hall_next_state[hall_sensors_state]] - hall_angle;
+		int16_t distance_x256 = ((int16_t)sector_angle << 8) + angle_error_x256 + rotor_angle_integral_x256;
+		if (distance_x256 < 256)
+		{
+			distance_x256 = 256;
+		}
+
+		// distance * 16 / sector_x16 as two 16bit divisions (remainder < 4096),
+		// only once per hall sensor transition
+		uint16_t quotient = (uint16_t)distance_x256 / sector_x16;
+		uint16_t remainder = (uint16_t)distance_x256 - quotient * sector_x16;
+		rotor_angle_delta_x256 = (quotient << 4) + ((remainder << 4) / sector_x16);
+		rotor_angle_max_advance_x256 = (uint16_t)distance_x256 + ROTOR_OBSERVER_OVERSHOOT_X256;
+		rotor_angle_advance_x256 = edge_advance_x256;
+
 		hall_sensor_error = false;
 		pwm_cycles_counter_6 = 1;
 	}
 
 	// count number of fast loops / pwm cycles and reset some states when motor is near zero speed
-	if (pwm_cycles_counter < PWM_CYCLES_COUNTER_MAX)
+	if (pwm_cycles_counter < pwm_cycles_counter_max)
 	{
 		pwm_cycles_counter++;
 		pwm_cycles_counter_6++;
@@ -725,27 +2044,23 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 		pwm_cycles_counter = 1; // don't put to 0 to avoid 0 divisions
 		pwm_cycles_counter_6 = 1;
 		half_erps_flag = 0;
-		speed_erps = 0;
-		pwm_cycles_counter_total = 0xffff;
+		hall_erev_pwm_cycles = 0;
+		hall_erev_start_valid = false;
+		hall_edge_last_valid = false;
 		foc_angle = 0;
 		commutation_type = BLOCK_COMMUTATION;
 		hall_sensors_state_last = 0; // this way we force execution of hall sensors code next time
 	}
 
-	// calc interpolation angle and sinewave table index
-	uint8_t svm_table_index = rotor_absolute_angle + foc_angle;
-
-#if 1 // may be useful to disable interpolation when debugging
-
-	// calculate the interpolation angle (and it doesn't work when motor starts and at very low speeds)
-	if (commutation_type == SINEWAVE_INTERPOLATION_60_DEGREES)
+	// advance rotor angle observer (it doesn't work when motor starts and at very low speeds)
+	if (commutation_type == SINEWAVE_OBSERVER && rotor_angle_advance_x256 < rotor_angle_max_advance_x256)
 	{
-		// division by 0: motor_pwm_cycles_counter_total should never be 0
-		// TODO: verifiy if (motor_pwm_cycles_counter_6 << 8) do not overflow
-		uint8_t interpolation_angle = (pwm_cycles_counter_6 << 8) / pwm_cycles_counter_total; // this operations take 4.4us
-		svm_table_index += interpolation_angle;
+		rotor_angle_x256 += rotor_angle_delta_x256;
+		rotor_angle_advance_x256 += rotor_angle_delta_x256;
 	}
-#endif
+
+	// calc sinewave table index
+	uint8_t svm_table_index = (uint8_t)(rotor_angle_x256 >> 8) + foc_angle;
 
 
 	// pwm duty cycle controller
@@ -762,6 +2077,7 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 	if	(
 			control_state == CONTROL_STATE_DISABLE ||
 			is_lvc_triggered ||
+			adc_current_missed_samples >= ADC_CURRENT_MAX_MISSED_SAMPLES ||
 			(pwm_duty_cycle_target == 0) ||
 			(GET_PIN_INPUT_STATE(PIN_BRAKE) == 0) //active low
 		)
@@ -774,12 +2090,10 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 	// do not control current at every PWM cycle, that will measure and control too fast. Use counter to limit
 	else if
 		(
-			current_controller_counter > CURRENT_CONTROLLER_CHECK_PERIODS &&
+			current_controller_counter > current_controller_check_periods &&
 			(
-				// check if truncated 8bit current reading did overflow
-				adc_battery_current_ovf ||
 				// compare against ramp controller current limit
-				adc_battery_current > adc_battery_ramp_max_current ||
+				adc_current_x4 > adc_battery_ramp_max_current_x4 ||
 				// or hard motor phase current limit
 				adc_phase_current > adc_phase_max_current
 			)
@@ -791,7 +2105,7 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 		}
 	}
 	else if (
-		speed_controller_counter > SPEED_CONTROLLER_CHECK_PERIODS && // test about every 100ms
+		speed_controller_counter > speed_controller_check_periods && // test about every 100ms
 		speed_erps > MAX_MOTOR_SPEED_ERPS
 	)
 	{
@@ -804,7 +2118,7 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 	{
 		if (pwm_duty_cycle_target > pwm_duty_cycle)
 		{
-			if (pwm_duty_cycle_ramp_up_counter++ >= PWM_DUTY_CYCLE_RAMP_UP_INVERSE_STEP)
+			if (pwm_duty_cycle_ramp_up_counter++ >= pwm_duty_cycle_ramp_up_inverse_step)
 			{
 				pwm_duty_cycle_ramp_up_counter = 0;
 				++pwm_duty_cycle;
@@ -812,7 +2126,7 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 		}
 		else if (pwm_duty_cycle_target < pwm_duty_cycle)
 		{
-			if (pwm_duty_cycle_ramp_down_counter++ >= PWM_DUTY_CYCLE_RAMP_DOWN_INVERSE_STEP)
+			if (pwm_duty_cycle_ramp_down_counter++ >= pwm_duty_cycle_ramp_down_inverse_step)
 			{
 				pwm_duty_cycle_ramp_down_counter = 0;
 				--pwm_duty_cycle;
@@ -821,12 +2135,12 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 	}
 
 	// reset periodic check counters
-	if (speed_controller_counter > SPEED_CONTROLLER_CHECK_PERIODS)
+	if (speed_controller_counter > speed_controller_check_periods)
 	{
 		speed_controller_counter = 0;
 	}
 
-	if (current_controller_counter > CURRENT_CONTROLLER_CHECK_PERIODS)
+	if (current_controller_counter > current_controller_check_periods)
 	{
 		current_controller_counter = 0;
 	}
@@ -834,74 +2148,162 @@ void isr_timer1_cmp(void) __interrupt(ITC_IRQ_TIM1_CAPCOM)
 
 	// calculate final pwm duty cycle values to be applied to TIMER1
 
-	// The first half of the table is the positive offset from the middle (0x100),
-	// in that case just set MSB to 0x1, and the value from the table*duty cycle to LSB.
-	// The second half of the table is a negative offset from that same middle,
-	// and should be substracted from 0x100.
-	// To cheat, we leave it as 0x100 when this value * duty cycle is 0,
-	// otherwise we assume MSB is 0, and just invert the value from the table from LSB.
+	// The first half of the table is the positive offset from the middle of the
+	// pwm period (0x100 at 15.6kHz), the second half of the table is a negative
+	// offset from that same middle.
 	// Checking to see if svm_table_index >= 128 (180 degrees) by & 0x80,
 	// as SDCC is not yet smart enough to do that automatically.
-	#define CALC_PHASE(PHASE_OUTPUT) do {												\
-		uint8_t tmp = ((uint16_t)(pwm_duty_cycle * svm_table[svm_table_index]) / 256);	\
-		if (tmp > 0 && (svm_table_index & 0x80))										\
-		{																				\
-			PHASE_OUTPUT##_lsb = 0 - tmp;												\
-			PHASE_OUTPUT##_msb = 0;														\
-		}																				\
-		else																			\
-		{																				\
-			PHASE_OUTPUT##_lsb = tmp;													\
-			PHASE_OUTPUT##_msb = 1;														\
-		}																				\
+	// Duty cycle is scaled to the pwm period at higher pwm frequencies.
+	// Table values already scaled by duty cycle are used when available (steady state),
+	// table built for a duty cycle one step off is accepted.
+	uint8_t output_duty_cycle = pwm_duty_cycle;
+	volatile uint8_t* svm_duty_table = 0;
+	uint8_t svm_duty_table_index = svm_duty_table_active;
+	if (svm_duty_table_index != SVM_DUTY_TABLE_NONE &&
+		(uint8_t)(output_duty_cycle - svm_duty_table_duty_cycle[svm_duty_table_index] + 1) <= 2)
+	{
+		svm_duty_table = svm_duty_tables[svm_duty_table_index];
+		svm_duty_table_hits++;
+	}
+	else if (pwm_output_scale != 0)
+	{
+		output_duty_cycle = (uint8_t)(((uint16_t)output_duty_cycle * pwm_output_scale) >> 8);
+	}
+
+	#define CALC_PHASE(PHASE_OUTPUT) do {											\
+		uint8_t tmp = svm_duty_table ?												\
+			svm_duty_table[svm_table_index & 0x7f] :								\
+			((uint16_t)(output_duty_cycle * svm_table[svm_table_index]) / 256);		\
+		if (svm_table_index & 0x80)													\
+		{																			\
+			PHASE_OUTPUT = pwm_center_ticks - tmp;									\
+		}																			\
+		else																		\
+		{																			\
+			PHASE_OUTPUT = pwm_center_ticks + tmp;									\
+		}																			\
 	} while (0)
 
 
 	// phase B as reference phase
-	uint8_t phase_b_voltage_msb;
-	uint8_t phase_b_voltage_lsb;
+	uint16_t phase_b_voltage;
 	CALC_PHASE(phase_b_voltage);
 
 	// phase C is advanced 120 degrees over phase B
 	svm_table_index += 85; // 120º / 360 * 256 = 85
-	uint8_t phase_c_voltage_msb;
-	uint8_t phase_c_voltage_lsb;
+	uint16_t phase_c_voltage;
 	CALC_PHASE(phase_c_voltage);
 
 	// phase A is advanced 240 degrees over phase B
 	svm_table_index += 86; // 240º / 360 * 256 = 171 - 85 already added = 86
-	uint8_t phase_a_voltage_msb;
-	uint8_t phase_a_voltage_lsb;
+	uint16_t phase_a_voltage;
 	CALC_PHASE(phase_a_voltage);
 
 
+	// dead time compensation, phase current is positive in first half of
+	// table when indexed by rotor angle (without foc angle),
+	// output is kept within compare range 0 - auto reload period
+	#define COMPENSATE_DEAD_TIME(PHASE_OUTPUT, CURRENT_INDEX) do {	\
+		if ((CURRENT_INDEX) & 0x80)									\
+		{															\
+			PHASE_OUTPUT = PHASE_OUTPUT > DEAD_TIME_COMPENSATION ?	\
+				PHASE_OUTPUT - DEAD_TIME_COMPENSATION : 0;			\
+		}															\
+		else														\
+		{															\
+			PHASE_OUTPUT = PHASE_OUTPUT < pwm_max_compare_ticks - DEAD_TIME_COMPENSATION ?	\
+				PHASE_OUTPUT + DEAD_TIME_COMPENSATION : pwm_max_compare_ticks;	\
+		}															\
+	} while (0)
+
+	if (adc_phase_current > DEAD_TIME_COMPENSATION_MIN_ADC_CURRENT)
+	{
+		uint8_t current_index = (uint8_t)(rotor_angle_x256 >> 8);
+		COMPENSATE_DEAD_TIME(phase_b_voltage, current_index);
+		COMPENSATE_DEAD_TIME(phase_c_voltage, (uint8_t)(current_index + 85));
+		COMPENSATE_DEAD_TIME(phase_a_voltage, (uint8_t)(current_index + 171));
+	}
+
+
 	// set final duty cycle value to pwm timers
 	// phase B
-	TIM1->CCR3H = phase_b_voltage_msb;
-	TIM1->CCR3L = phase_b_voltage_lsb;
+	TIM1->CCR3H = (uint8_t)(phase_b_voltage >> 8);
+	TIM1->CCR3L = (uint8_t)phase_b_voltage;
 	// phase C
-	TIM1->CCR2H = phase_c_voltage_msb;
-	TIM1->CCR2L = phase_c_voltage_lsb;
+	TIM1->CCR2H = (uint8_t)(phase_c_voltage >> 8);
+	TIM1->CCR2L = (uint8_t)phase_c_voltage;
 	// phase A
-	TIM1->CCR1H = phase_a_voltage_msb;
-	TIM1->CCR1L = phase_a_voltage_lsb;
+	TIM1->CCR1H = (uint8_t)(phase_a_voltage >> 8);
+	TIM1->CCR1L = (uint8_t)phase_a_voltage;
 	
 
 	// ramp up motor current
-	if (adc_battery_target_current > adc_battery_ramp_max_current)
+	if (adc_battery_target_current_x4 > adc_battery_ramp_max_current_x4)
 	{
-		if (adc_current_ramp_up_counter++ >= CURRENT_RAMP_UP_INVERSE_STEP)
+		if (adc_current_ramp_up_counter++ >= (current_ramp_fast ?
+			adc_current_ramp_up_fast_inverse_step : adc_current_ramp_up_inverse_step))
 		{
 			adc_current_ramp_up_counter = 0;
-			adc_battery_ramp_max_current++;
+			adc_battery_ramp_max_current_x4++;
 		}
 	}
-	else if (adc_battery_target_current < adc_battery_ramp_max_current)
+	else if (adc_battery_target_current_x4 < adc_battery_ramp_max_current_x4)
 	{
 		// we are not doing a ramp down here, just directly setting to the target value
-		adc_battery_ramp_max_current = adc_battery_target_current;
+		adc_battery_ramp_max_current_x4 = adc_battery_target_current_x4;
+	}
+
+	// execution time, checked against pwm period in main loop
+	uint16_t isr_ticks = read_pwm_cycle_ticks();
+	if (isr_ticks > pwm_isr_max_ticks)
+	{
+		pwm_isr_max_ticks = isr_ticks;
 	}
 
 	// clears the timer1 interrupt CC4 pending bit
 	TIM1->SR1 = (uint8_t)(~(uint8_t)TIM1_IT_CC4);
+	pwm_cycle_done = pwm_cycle;
+}
+
+// Hall sensor transition, preempts pwm interrupt (priority level 3).
+// Timestamp is pwm cycle number and timer1 ticks since cc4 interrupt of that cycle.
+static void hall_sensor_edge()
+{
+	uint8_t state = read_hall_sensors_state();
+	if (state == hall_edge_state)
+	{
+		return;
+	}
+
+	uint16_t ticks = read_pwm_cycle_ticks();
+	uint8_t cc4_pending = TIM1->SR1 & TIM1_SR1_CC4IF;
+
+	uint8_t cycle = pwm_cycle;
+
+	// cc4 event has happened but pwm interrupt has not yet incremented the cycle number,
+	// ticks is checked since event can happen between reading counter and flag
+	if (cc4_pending && cycle == pwm_cycle_done && ticks < (pwm_period_ticks / 2))
+	{
+		cycle++;
+	}
+
+	hall_edge_state = state;
+	hall_edge_pwm_cycle = cycle;
+	hall_edge_ticks = ticks;
+	hall_edge_sequence++;
+}
+
+void isr_exti_portc(void) __interrupt(ITC_IRQ_PORTC)
+{
+	hall_sensor_edge(); // hall sensor C
+}
+
+void isr_exti_portd(void) __interrupt(ITC_IRQ_PORTD)
+{
+	hall_sensor_edge(); // hall sensor B
+}
+
+void isr_exti_porte(void) __interrupt(ITC_IRQ_PORTE)
+{
+	hall_sensor_edge(); // hall sensor A
 }
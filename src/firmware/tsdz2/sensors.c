@@ -7,6 +7,7 @@
  */
 
 #include "sensors.h"
+#include "system.h"
 #include "intellisense.h"
 #include "fwconfig.h"
 #include "tsdz2/interrupt.h"
@@ -35,10 +36,14 @@ static bool pas_prev2;
 static uint16_t pas_stop_delay_periods;
 
 static volatile uint16_t speed_ticks_period_length; // pulse length counted in interrupt frequency (100us)
+static volatile uint16_t speed_pulse_counter;
 static uint16_t speed_period_counter;
 static bool speed_prev_state;
 static uint8_t speed_ticks_per_rpm;
 
+static volatile bool event_pending;
+static bool brake_prev_state;
+
 extern void torque_sensor_init();
 extern void torque_sensor_process();
 
@@ -51,8 +56,10 @@ void sensors_init()
 	pas_stop_delay_periods = 1500;
 	speed_period_counter = 0;
 	speed_ticks_period_length = 0;
+	speed_pulse_counter = 0;
 	speed_prev_state = false;
 	speed_ticks_per_rpm = 1;
+	event_pending = false;
 
 	// pins do not have external interrupt, use timer0 to evaluate state frequently
 	SET_PIN_INPUT(PIN_PAS1);
@@ -62,6 +69,7 @@ void sensors_init()
 
 	pas_prev1 = GET_PIN_INPUT_STATE(PIN_PAS1);
 	pas_prev2 = GET_PIN_INPUT_STATE(PIN_PAS2);
+	brake_prev_state = GET_PIN_INPUT_STATE(PIN_BRAKE);
 
 	torque_sensor_init();
 	torque_sensor_process();
@@ -74,6 +82,57 @@ void sensors_process()
 	torque_sensor_process();
 }
 
+void sensors_snapshot(sensors_snapshot_t* snapshot)
+{
+	uint16_t pas_period;
+	bool pas_backward;
+	uint16_t speed_period;
+
+	TIM4->IER &= ~TIM4_IT_UPDATE; // disable timer4 interrupts
+	pas_period = pas_period_length;
+	pas_backward = pas_direction_backward;
+	snapshot->pas_pulse_counter = pas_pulse_counter;
+	speed_period = speed_ticks_period_length;
+	snapshot->speed_pulse_counter = speed_pulse_counter;
+	TIM4->IER |= TIM4_IT_UPDATE;
+
+	if (pas_period > 0)
+	{
+		snapshot->pas_cadence_rpm_x10 = (uint16_t)((6000000ul / PAS_SENSOR_NUM_SIGNALS) / pas_period);
+	}
+	else
+	{
+		snapshot->pas_cadence_rpm_x10 = 0;
+	}
+	snapshot->pas_pedaling_forwards = pas_period > 0 && !pas_backward;
+	snapshot->pas_pedaling_backwards = pas_period > 0 && pas_backward;
+
+	if (speed_period > 0)
+	{
+		snapshot->speed_rpm_x10 = 6000000ul / speed_period / speed_ticks_per_rpm;
+	}
+	else
+	{
+		snapshot->speed_rpm_x10 = 0;
+	}
+	snapshot->speed_moving = speed_period > 0;
+
+	snapshot->torque_nm_x100 = torque_sensor_get_nm_x100();
+	snapshot->brake = brake_is_activated();
+	snapshot->shift_sensor = shift_sensor_is_activated();
+	snapshot->ms = system_ms();
+}
+
+bool sensors_event_pending()
+{
+	bool tmp;
+	TIM4->IER &= ~TIM4_IT_UPDATE; // disable timer4 interrupts
+	tmp = event_pending;
+	event_pending = false;
+	TIM4->IER |= TIM4_IT_UPDATE;
+
+	return tmp;
+}
 
 void pas_set_stop_delay(uint16_t delay_ms)
 {
@@ -162,6 +221,16 @@ uint16_t speed_sensor_get_rpm_x10()
 	return 0;
 }
 
+uint16_t speed_sensor_get_pulse_counter()
+{
+	uint16_t tmp;
+	TIM4->IER &= ~TIM4_IT_UPDATE; // disable timer4 interrupts
+	tmp = speed_pulse_counter;
+	TIM4->IER |= TIM4_IT_UPDATE;
+
+	return tmp;
+}
+
 
 int16_t temperature_contr_x100()
 {
@@ -198,6 +267,7 @@ void isr_timer4_ovf(void) __interrupt(ITC_IRQ_TIM4_OVF)
 		if (pas1 && !pas_prev1 /* && pas_period_counter > PAS_SENSOR_MIN_PULSE_MS_X10 */)
 		{
 			pas_pulse_counter++;
+			event_pending = true;
 
 			if (pas_direction_backward != pas2)
 			{
@@ -243,12 +313,25 @@ void isr_timer4_ovf(void) __interrupt(ITC_IRQ_TIM4_OVF)
 	}
 
 
+	// Brake
+	{
+		bool brake = GET_PIN_INPUT_STATE(PIN_BRAKE);
+		if (brake != brake_prev_state)
+		{
+			brake_prev_state = brake;
+			event_pending = true;
+		}
+	}
+
+
 	// Speed sensor
 	{
 		bool spd = GET_PIN_INPUT_STATE(PIN_SPEED_SENSOR);
 
 		if (spd && !speed_prev_state && speed_period_counter > SPEED_SENSOR_MIN_PULSE_MS_X10)
 		{
+			++speed_pulse_counter;
+
 			if (speed_period_counter <= SPEED_SENSOR_TIMEOUT_MS_X10)
 			{
 				speed_ticks_period_length = speed_period_counter;
@@ -15,7 +15,6 @@
 #include "tsdz2/stm8s/stm8s_tim3.h"
 #include "tsdz2/stm8s/stm8s_tim4.h"
 
-#define TIM1_AUTO_RELOAD_PERIOD			511
 #define TIM2_AUTO_RELOAD_PERIOD			159		// 20us
 #define TIM3_AUTO_RELOAD_PERIOD			15999	// 1ms
 #define TIM4_AUTO_RELOAD_PERIOD			99		// 100us
@@ -111,14 +110,12 @@ void timer1_init_motor_pwm()
 	TIM1->OISR &= (uint8_t)(~TIM1_OISR_OIS4);
 
 	// timming for interrupt firing (hand adjusted)
-	const uint16_t Timing = 285;
-
-	TIM1->CCR4H = (uint8_t)(Timing >> 8);
-	TIM1->CCR4L = (uint8_t)Timing;
+	TIM1->CCR4H = (uint8_t)(TIM1_CC4_COMPARE >> 8);
+	TIM1->CCR4L = (uint8_t)TIM1_CC4_COMPARE;
 
 	// hardware needs a dead time of 1us
-	//	16, // DTG = 0; dead time in 62.5 ns steps; 1us/62.5ns = 16
-	TIM1->DTR = (uint8_t)16;
+	// DTG = 0; dead time in 62.5 ns steps
+	TIM1->DTR = (uint8_t)TIM1_DEAD_TIME_TICKS;
 
 	TIM1->BKR = (uint8_t)(
 		TIM1_OSSISTATE_ENABLE |
@@ -137,6 +134,19 @@ void timer1_init_motor_pwm()
 	TIM1->BKR |= TIM1_BKR_MOE;
 }
 
+void timer1_set_motor_pwm_period(uint16_t auto_reload_period)
+{
+	// keep cc4 interrupt at same relative position in pwm cycle
+	uint16_t cc4_compare = (uint16_t)(((uint32_t)TIM1_CC4_COMPARE * auto_reload_period) / TIM1_AUTO_RELOAD_PERIOD);
+
+	// only called when outputs are disabled
+	TIM1->ARRH = (uint8_t)(auto_reload_period >> 8);
+	TIM1->ARRL = (uint8_t)auto_reload_period;
+
+	TIM1->CCR4H = (uint8_t)(cc4_compare >> 8);
+	TIM1->CCR4L = (uint8_t)cc4_compare;
+}
+
 void timer2_init_torque_sensor_pwm()
 {
 	// Timer2 is used to create the pulse signal for excitation of the torque sensor circuit
@@ -9,8 +9,22 @@
 #ifndef _TSDZ2_TIMERS_H_
 #define _TSDZ2_TIMERS_H_
 
+#include <stdint.h>
+
+// timer1 clock = 16MHz, center aligned pwm, period is 2 * auto reload ticks
+// default 15.6kHz, other frequencies set by timer1_set_motor_pwm_period
+#define TIM1_CLOCK_HZ					16000000UL
+#define TIM1_AUTO_RELOAD_PERIOD			511
+
+// timing for cc4 interrupt firing, matched when counting down (hand adjusted)
+// at default period, scaled with the auto reload period
+#define TIM1_CC4_COMPARE				285
+
+// hardware needs a dead time of 1us, in 62.5 ns steps; 1us/62.5ns = 16
+#define TIM1_DEAD_TIME_TICKS			16
 
 void timer1_init_motor_pwm();
+void timer1_set_motor_pwm_period(uint16_t auto_reload_period);
 void timer2_init_torque_sensor_pwm();
 void timer3_init_system();
 void timer4_init_sensors();
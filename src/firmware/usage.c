@@ -0,0 +1,72 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#include "usage.h"
+#include "motor.h"
+#include "sensors.h"
+#include "system.h"
+#include "cfgstore.h"
+#include "util.h"
+
+/*
+Ridden distance and used battery energy, integrated every 100ms in one place
+for battery energy count, range estimate and statistics.
+
+Distance is counted from speed sensor pulses and energy from measured battery
+voltage and current. Counters are free running, users keep the last read value
+and accumulate the (unsigned) difference.
+*/
+
+static uint16_t wheel_circumference_mm;
+static uint16_t last_pulse_counter;
+static uint32_t distance_mm;
+static uint32_t energy_mj;
+static uint32_t next_update_ms;
+
+void usage_init()
+{
+	// wheel_size_inch_x10 * 2.54 * pi / 10
+	wheel_circumference_mm = (uint16_t)(EXPAND_U16(g_config.wheel_size_inch_x10_u16h, g_config.wheel_size_inch_x10_u16l) * 0.79796f);
+	last_pulse_counter = speed_sensor_get_pulse_counter();
+	distance_mm = 0;
+	energy_mj = 0;
+	next_update_ms = 0;
+}
+
+void usage_process()
+{
+	uint32_t now = system_ms();
+	if (now < next_update_ms)
+	{
+		return;
+	}
+
+	next_update_ms = now + 100;
+
+	// 0.1V * 0.1A * 0.1s = 1mJ
+	energy_mj += (uint32_t)motor_get_battery_voltage_x10() * motor_get_battery_current_x10();
+
+	uint16_t pulse_counter = speed_sensor_get_pulse_counter();
+	uint16_t pulses = pulse_counter - last_pulse_counter;
+	last_pulse_counter = pulse_counter;
+
+	if (pulses > 0)
+	{
+		distance_mm += ((uint32_t)pulses * wheel_circumference_mm) / g_config.speed_sensor_signals;
+	}
+}
+
+uint32_t usage_get_distance_mm()
+{
+	return distance_mm;
+}
+
+uint32_t usage_get_energy_mj()
+{
+	return energy_mj;
+}
@@ -0,0 +1,21 @@
+/*
+ * bbs-fw
+ *
+ * Copyright (C) Daniel Nilsson, 2022.
+ *
+ * Released under the GPL License, Version 3
+ */
+
+#ifndef _USAGE_H_
+#define _USAGE_H_
+
+#include <stdint.h>
+
+void usage_init();
+void usage_process();
+
+// Free running counters, wrap around. Use difference between reads.
+uint32_t usage_get_distance_mm();
+uint32_t usage_get_energy_mj();
+
+#endif
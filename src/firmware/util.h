@@ -14,6 +14,11 @@
 #define MAP16(x, in_min, in_max, out_min, out_max)	((((int16_t)x) - (in_min)) * ((out_max) - (out_min)) / ((in_max) - (in_min)) + (out_min))
 #define MAP32(x, in_min, in_max, out_min, out_max)	((((int32_t)x) - (in_min)) * ((out_max) - (out_min)) / ((in_max) - (in_min)) + (out_min))
 
+// Linear map using precomputed 16.16 fixed point slope, no division at runtime.
+// Product (x - in_min) * slope must fit in int32.
+#define SLOPE_X65536(in_range, out_range)				((((int32_t)(out_range)) << 16) / (in_range))
+#define MAP_SLOPE32(x, in_min, out_min, slope_x65536)	((((((int32_t)x) - (in_min)) * (slope_x65536)) >> 16) + (out_min))
+
 #define EXPAND_U16(high, low) ((((uint16_t)high) << 8) | (uint8_t)low)
 #define EXPAND_I16(high, low) ((int16_t)EXPAND_U16(high,low))
 
@@ -49,6 +49,7 @@ namespace BBSFW.Model
 		private const int OPCODE_WRITE_CONFIG =			0xf1;
 		private const int OPCODE_WRITE_RESET_CONFIG =	0xf2;
 		private const int OPCODE_WRITE_ADC_VOLTAGE_CALIBRATION = 0xf3;
+		private const int OPCODE_WRITE_MOTOR_CALIBRATION = 0xf4;
 
 		private const int Keep = 0;
 		private const int Discard = -1;
@@ -66,6 +67,7 @@ namespace BBSFW.Model
 		private CompletionQueue<bool> _writeConfigCq = new CompletionQueue<bool>();
 		private CompletionQueue<bool> _writeResetConfigCq = new CompletionQueue<bool>();
 		private CompletionQueue<bool> _writeVoltageCalibrationCq = new CompletionQueue<bool>();
+		private CompletionQueue<bool> _writeMotorCalibrationCq = new CompletionQueue<bool>();
 
 
 		private int ConfigVersion = 0;
@@ -186,6 +188,12 @@ namespace BBSFW.Model
 			return await _writeVoltageCalibrationCq.WaitResponse(timeout);
 		}
 
+		public async Task<RequestResult<bool>> StartMotorCalibration(TimeSpan timeout)
+		{
+			SendWriteMotorCalibration();
+			return await _writeMotorCalibrationCq.WaitResponse(timeout);
+		}
+
 
 		private void OnDataReceived(object sender, SerialDataReceivedEventArgs e)
 		{
@@ -411,6 +419,9 @@ namespace BBSFW.Model
 					case 5:
 						cfg.ParseFromBufferV5(_rxBuffer.Skip(4).Take(Configuration.GetByteSize(version)).ToArray());
 						break;
+					case 6:
+						cfg.ParseFromBufferV6(_rxBuffer.Skip(4).Take(Configuration.GetByteSize(version)).ToArray());
+						break;
 				}
 
 				_readConfigCq.Complete(cfg);
@@ -441,6 +452,8 @@ namespace BBSFW.Model
 					return ProcessWriteResponseResetConfig();
 				case OPCODE_WRITE_ADC_VOLTAGE_CALIBRATION:
 					return ProcessWriteResponseVoltageCalibration();
+				case OPCODE_WRITE_MOTOR_CALIBRATION:
+					return ProcessWriteResponseMotorCalibration();
 			}
 
 			return Discard;
@@ -502,6 +515,20 @@ namespace BBSFW.Model
 			return MessageSize;
 		}
 
+		private int ProcessWriteResponseMotorCalibration()
+		{
+			const int MessageSize = 4;
+
+			if (_rxBuffer.Count < MessageSize)
+			{
+				return Keep;
+			}
+
+			_writeMotorCalibrationCq.Complete(_rxBuffer[2] != 0);
+
+			return MessageSize;
+		}
+
 		private int ProcessEventLogEntry()
 		{
 			if (_rxBuffer[0] == EVENT_LOG_ENTRY)
@@ -616,6 +643,16 @@ namespace BBSFW.Model
 			_port.Write(buf.ToArray(), 0, buf.Count);
 		}
 
+		private void SendWriteMotorCalibration()
+		{
+			var buf = new List<byte>();
+			buf.Add(REQUEST_TYPE_WRITE);
+			buf.Add(OPCODE_WRITE_MOTOR_CALIBRATION);
+			buf.Add(ComputeChecksum(buf, buf.Count));
+
+			_port.Write(buf.ToArray(), 0, buf.Count);
+		}
+
 		private bool SetupConnection(TimeSpan timeout)
 		{
 			var start = DateTime.Now;
@@ -11,7 +11,7 @@ namespace BBSFW.Model
 	[XmlRoot("BBSFW", Namespace ="https://github.com/danielnilsson9/bbs-fw")]
 	public class Configuration
 	{
-		public const int CurrentVersion = 5;
+		public const int CurrentVersion = 6;
 		public const int MinVersion = 1;
 		public const int MaxVersion = CurrentVersion;
 
@@ -20,13 +20,15 @@ namespace BBSFW.Model
 		public const int ByteSizeV3 = 149;
 		public const int ByteSizeV4 = 152;
 		public const int ByteSizeV5 = 154;
+		public const int ByteSizeV6 = 181;
 
 		public enum Feature
 		{
 			ShiftSensor,
 			TorqueSensor,
 			ControllerTemperatureSensor,
-			MotorTemperatureSensor
+			MotorTemperatureSensor,
+			MotorControl
 		}
 
 		public static int GetByteSize(int version)
@@ -43,6 +45,8 @@ namespace BBSFW.Model
 					return ByteSizeV4;
 				case 5:
 					return ByteSizeV5;
+				case 6:
+					return ByteSizeV6;
 			}
 
 			return 0;
@@ -111,6 +115,13 @@ namespace BBSFW.Model
 			BrakeLight = 3
 		}
 
+		public enum PwmFrequencyOptions
+		{
+			Frequency15_6kHz = 0,
+			Frequency19_5kHz = 1,
+			Frequency23_4kHz = 2
+		}
+
 		public class AssistLevel
 		{
 			[XmlAttribute]
@@ -130,6 +141,9 @@ namespace BBSFW.Model
 
 			[XmlAttribute]
 			public float TorqueAmplificationFactor;
+
+			[XmlAttribute]
+			public uint MaxPowerWatts;
 		}
 
 		[XmlIgnore]
@@ -162,7 +176,15 @@ namespace BBSFW.Model
 		public uint CurrentRampAmpsSecond;
 		public float MaxBatteryVolts;
 		public uint LowCutoffVolts;
+		public float BatteryCapacityAmpHours;
+		public float LowVoltageFloorMarginVolts;
 		public uint MaxSpeedKph;
+		public uint BoostCurrentAmps;
+		public uint BoostDurationSeconds;
+
+		// motor
+		public uint MotorInductanceMicroHenry;
+		public PwmFrequencyOptions MotorPwmFrequency;
 
 		// externals
 		public bool UseSpeedSensor;
@@ -219,6 +241,13 @@ namespace BBSFW.Model
 			MaxBatteryVolts = 0;
 			LowCutoffVolts = 0;
 
+			MotorInductanceMicroHenry = 0;
+			MotorPwmFrequency = PwmFrequencyOptions.Frequency15_6kHz;
+			BoostCurrentAmps = 0;
+			BoostDurationSeconds = 10;
+			BatteryCapacityAmpHours = 0;
+			LowVoltageFloorMarginVolts = 1f;
+
 			UseSpeedSensor = false;
 			UseShiftSensor = false;
 			UsePushWalk = false;
@@ -279,6 +308,8 @@ namespace BBSFW.Model
 					return new[] { BbsfwConnection.Controller.BBSHD, BbsfwConnection.Controller.BBS02 }.Contains(Target);
 				case Feature.MotorTemperatureSensor:
 					return new[] { BbsfwConnection.Controller.BBSHD }.Contains(Target);
+				case Feature.MotorControl:
+					return new[] { BbsfwConnection.Controller.TSDZ2 }.Contains(Target);
 			}
 
 			return false;
@@ -354,6 +385,12 @@ namespace BBSFW.Model
 			ThrottleGlobalSpeedLimitPercent = 100;
 			UsePretension = false;
 			PretensionSpeedCutoffKph = 0;
+			MotorInductanceMicroHenry = 0;
+			MotorPwmFrequency = PwmFrequencyOptions.Frequency15_6kHz;
+			BoostCurrentAmps = 0;
+			BoostDurationSeconds = 10;
+			BatteryCapacityAmpHours = 0;
+			LowVoltageFloorMarginVolts = 1f;
 
 			return true;
 		}
@@ -431,6 +468,12 @@ namespace BBSFW.Model
 			ThrottleGlobalSpeedLimitPercent = 100;
 			UsePretension = false;
 			PretensionSpeedCutoffKph = 0;
+			MotorInductanceMicroHenry = 0;
+			MotorPwmFrequency = PwmFrequencyOptions.Frequency15_6kHz;
+			BoostCurrentAmps = 0;
+			BoostDurationSeconds = 10;
+			BatteryCapacityAmpHours = 0;
+			LowVoltageFloorMarginVolts = 1f;
 
 			return true;
 		}
@@ -487,6 +530,7 @@ namespace BBSFW.Model
 					StandardAssistLevels[i].MaxCadencePercent = br.ReadByte();
 					StandardAssistLevels[i].MaxSpeedPercent = br.ReadByte();
 					StandardAssistLevels[i].TorqueAmplificationFactor = br.ReadByte() / 10f;
+					StandardAssistLevels[i].MaxPowerWatts = 0;
 				}
 
 				for (int i = 0; i < SportAssistLevels.Length; ++i)
@@ -497,6 +541,7 @@ namespace BBSFW.Model
 					SportAssistLevels[i].MaxCadencePercent = br.ReadByte();
 					SportAssistLevels[i].MaxSpeedPercent = br.ReadByte();
 					SportAssistLevels[i].TorqueAmplificationFactor = br.ReadByte() / 10f;
+					SportAssistLevels[i].MaxPowerWatts = 0;
 				}
 			}
 
@@ -506,6 +551,12 @@ namespace BBSFW.Model
 			ThrottleGlobalSpeedLimitPercent = 100;
 			UsePretension = false;
 			PretensionSpeedCutoffKph = 0;
+			MotorInductanceMicroHenry = 0;
+			MotorPwmFrequency = PwmFrequencyOptions.Frequency15_6kHz;
+			BoostCurrentAmps = 0;
+			BoostDurationSeconds = 10;
+			BatteryCapacityAmpHours = 0;
+			LowVoltageFloorMarginVolts = 1f;
 
 			return true;
 		}
@@ -565,6 +616,7 @@ namespace BBSFW.Model
 					StandardAssistLevels[i].MaxCadencePercent = br.ReadByte();
 					StandardAssistLevels[i].MaxSpeedPercent = br.ReadByte();
 					StandardAssistLevels[i].TorqueAmplificationFactor = br.ReadByte() / 10f;
+					StandardAssistLevels[i].MaxPowerWatts = 0;
 				}
 
 				for (int i = 0; i < SportAssistLevels.Length; ++i)
@@ -575,12 +627,19 @@ namespace BBSFW.Model
 					SportAssistLevels[i].MaxCadencePercent = br.ReadByte();
 					SportAssistLevels[i].MaxSpeedPercent = br.ReadByte();
 					SportAssistLevels[i].TorqueAmplificationFactor = br.ReadByte() / 10f;
+					SportAssistLevels[i].MaxPowerWatts = 0;
 				}
 			}
 
 			// apply default settings for non existing options in version
 			UsePretension = false;
 			PretensionSpeedCutoffKph = 0;
+			MotorInductanceMicroHenry = 0;
+			MotorPwmFrequency = PwmFrequencyOptions.Frequency15_6kHz;
+			BoostCurrentAmps = 0;
+			BoostDurationSeconds = 10;
+			BatteryCapacityAmpHours = 0;
+			LowVoltageFloorMarginVolts = 1f;
 
 			return true;
 		}
@@ -642,6 +701,7 @@ namespace BBSFW.Model
 					StandardAssistLevels[i].MaxCadencePercent = br.ReadByte();
 					StandardAssistLevels[i].MaxSpeedPercent = br.ReadByte();
 					StandardAssistLevels[i].TorqueAmplificationFactor = br.ReadByte() / 10f;
+					StandardAssistLevels[i].MaxPowerWatts = 0;
 				}
 
 				for (int i = 0; i < SportAssistLevels.Length; ++i)
@@ -652,6 +712,99 @@ namespace BBSFW.Model
 					SportAssistLevels[i].MaxCadencePercent = br.ReadByte();
 					SportAssistLevels[i].MaxSpeedPercent = br.ReadByte();
 					SportAssistLevels[i].TorqueAmplificationFactor = br.ReadByte() / 10f;
+					SportAssistLevels[i].MaxPowerWatts = 0;
+				}
+			}
+
+			// apply default settings for non existing options in version
+			MotorInductanceMicroHenry = 0;
+			MotorPwmFrequency = PwmFrequencyOptions.Frequency15_6kHz;
+			BoostCurrentAmps = 0;
+			BoostDurationSeconds = 10;
+			BatteryCapacityAmpHours = 0;
+			LowVoltageFloorMarginVolts = 1f;
+
+			return true;
+		}
+
+		public bool ParseFromBufferV6(byte[] buffer)
+		{
+			if (buffer.Length != ByteSizeV6)
+			{
+				return false;
+			}
+
+			using (var s = new MemoryStream(buffer))
+			{
+				var br = new BinaryReader(s);
+
+				UseFreedomUnits = br.ReadBoolean();
+
+				MaxCurrentAmps = br.ReadByte();
+				CurrentRampAmpsSecond = br.ReadByte();
+				MaxBatteryVolts = br.ReadUInt16() / 100f;
+				LowCutoffVolts = br.ReadByte();
+				MaxSpeedKph = br.ReadByte();
+
+				BatteryCapacityAmpHours = br.ReadUInt16() / 10f;
+				LowVoltageFloorMarginVolts = br.ReadByte() / 10f;
+
+				BoostCurrentAmps = br.ReadByte();
+				BoostDurationSeconds = br.ReadByte();
+
+				MotorInductanceMicroHenry = br.ReadByte();
+				MotorPwmFrequency = (PwmFrequencyOptions)br.ReadByte();
+
+				UseSpeedSensor = br.ReadBoolean();
+				UseShiftSensor = br.ReadBoolean();
+				UsePushWalk = br.ReadBoolean();
+				UseTemperatureSensor = (TemperatureSensor)br.ReadByte();
+				LightsMode = (LightsModeOptions)br.ReadByte();
+				UsePretension = br.ReadBoolean();
+				PretensionSpeedCutoffKph = br.ReadByte();
+
+				WheelSizeInch = br.ReadUInt16() / 10f;
+				NumWheelSensorSignals = br.ReadByte();
+
+				PasStartDelayPulses = br.ReadByte();
+				PasStopDelayMilliseconds = br.ReadByte() * 10u;
+				PasKeepCurrentPercent = br.ReadByte();
+				PasKeepCurrentCadenceRpm = br.ReadByte();
+
+				ThrottleStartMillivolts = br.ReadUInt16();
+				ThrottleEndMillivolts = br.ReadUInt16();
+				ThrottleStartPercent = br.ReadByte();
+				ThrottleGlobalSpeedLimit = (ThrottleGlobalSpeedLimitOptions)br.ReadByte();
+				ThrottleGlobalSpeedLimitPercent = br.ReadByte();
+
+				ShiftInterruptDuration = br.ReadUInt16();
+				ShiftInterruptCurrentThresholdPercent = br.ReadByte();
+
+				WalkModeDataDisplay = (WalkModeData)br.ReadByte();
+
+				AssistModeSelection = (AssistModeSelect)br.ReadByte();
+				AssistStartupLevel = br.ReadByte();
+
+				for (int i = 0; i < StandardAssistLevels.Length; ++i)
+				{
+					StandardAssistLevels[i].Type = (AssistFlagsType)br.ReadByte();
+					StandardAssistLevels[i].MaxCurrentPercent = br.ReadByte();
+					StandardAssistLevels[i].MaxThrottlePercent = br.ReadByte();
+					StandardAssistLevels[i].MaxCadencePercent = br.ReadByte();
+					StandardAssistLevels[i].MaxSpeedPercent = br.ReadByte();
+					StandardAssistLevels[i].TorqueAmplificationFactor = br.ReadByte() / 10f;
+					StandardAssistLevels[i].MaxPowerWatts = br.ReadByte() * 10u;
+				}
+
+				for (int i = 0; i < SportAssistLevels.Length; ++i)
+				{
+					SportAssistLevels[i].Type = (AssistFlagsType)br.ReadByte();
+					SportAssistLevels[i].MaxCurrentPercent = br.ReadByte();
+					SportAssistLevels[i].MaxThrottlePercent = br.ReadByte();
+					SportAssistLevels[i].MaxCadencePercent = br.ReadByte();
+					SportAssistLevels[i].MaxSpeedPercent = br.ReadByte();
+					SportAssistLevels[i].TorqueAmplificationFactor = br.ReadByte() / 10f;
+					SportAssistLevels[i].MaxPowerWatts = br.ReadByte() * 10u;
 				}
 			}
 
@@ -672,6 +825,15 @@ namespace BBSFW.Model
 				bw.Write((byte)LowCutoffVolts);
 				bw.Write((byte)MaxSpeedKph);
 
+				bw.Write((UInt16)Math.Round(BatteryCapacityAmpHours * 10));
+				bw.Write((byte)Math.Round(LowVoltageFloorMarginVolts * 10));
+
+				bw.Write((byte)BoostCurrentAmps);
+				bw.Write((byte)BoostDurationSeconds);
+
+				bw.Write((byte)MotorInductanceMicroHenry);
+				bw.Write((byte)MotorPwmFrequency);
+
 				bw.Write(UseSpeedSensor);
 				bw.Write(UseShiftSensor);
 				bw.Write(UsePushWalk);
@@ -710,6 +872,7 @@ namespace BBSFW.Model
 					bw.Write((byte)StandardAssistLevels[i].MaxCadencePercent);
 					bw.Write((byte)StandardAssistLevels[i].MaxSpeedPercent);
 					bw.Write((byte)Math.Round(StandardAssistLevels[i].TorqueAmplificationFactor * 10));
+					bw.Write((byte)(StandardAssistLevels[i].MaxPowerWatts / 10u));
 				}
 
 				for (int i = 0; i < SportAssistLevels.Length; ++i)
@@ -720,6 +883,7 @@ namespace BBSFW.Model
 					bw.Write((byte)SportAssistLevels[i].MaxCadencePercent);
 					bw.Write((byte)SportAssistLevels[i].MaxSpeedPercent);
 					bw.Write((byte)Math.Round(SportAssistLevels[i].TorqueAmplificationFactor * 10));
+					bw.Write((byte)(SportAssistLevels[i].MaxPowerWatts / 10u));
 				}
 
 				return s.ToArray();
@@ -735,6 +899,10 @@ namespace BBSFW.Model
 			CurrentRampAmpsSecond = cfg.CurrentRampAmpsSecond;
 			MaxBatteryVolts = cfg.MaxBatteryVolts;
 			LowCutoffVolts = cfg.LowCutoffVolts;
+			BatteryCapacityAmpHours = cfg.BatteryCapacityAmpHours;
+			LowVoltageFloorMarginVolts = cfg.LowVoltageFloorMarginVolts;
+			MotorInductanceMicroHenry = cfg.MotorInductanceMicroHenry;
+			MotorPwmFrequency = cfg.MotorPwmFrequency;
 			UseSpeedSensor = cfg.UseSpeedSensor;
 			UseShiftSensor = cfg.UseShiftSensor;
 			UsePushWalk = cfg.UsePushWalk;
@@ -745,6 +913,8 @@ namespace BBSFW.Model
 			WheelSizeInch = cfg.WheelSizeInch;
 			NumWheelSensorSignals = cfg.NumWheelSensorSignals;
 			MaxSpeedKph = cfg.MaxSpeedKph;
+			BoostCurrentAmps = cfg.BoostCurrentAmps;
+			BoostDurationSeconds = cfg.BoostDurationSeconds;
 			PasStartDelayPulses = cfg.PasStartDelayPulses;
 			PasStopDelayMilliseconds = cfg.PasStopDelayMilliseconds;
 			PasKeepCurrentPercent = cfg.PasKeepCurrentPercent;
@@ -768,6 +938,7 @@ namespace BBSFW.Model
 				StandardAssistLevels[i].MaxCadencePercent = cfg.StandardAssistLevels[i].MaxCadencePercent;
 				StandardAssistLevels[i].MaxSpeedPercent = cfg.StandardAssistLevels[i].MaxSpeedPercent;
 				StandardAssistLevels[i].TorqueAmplificationFactor = cfg.StandardAssistLevels[i].TorqueAmplificationFactor;
+				StandardAssistLevels[i].MaxPowerWatts = cfg.StandardAssistLevels[i].MaxPowerWatts;
 			}
 
 			for (int i = 0; i < Math.Min(cfg.SportAssistLevels.Length, SportAssistLevels.Length); ++i)
@@ -778,6 +949,7 @@ namespace BBSFW.Model
 				SportAssistLevels[i].MaxCadencePercent = cfg.SportAssistLevels[i].MaxCadencePercent;
 				SportAssistLevels[i].MaxSpeedPercent = cfg.SportAssistLevels[i].MaxSpeedPercent;
 				SportAssistLevels[i].TorqueAmplificationFactor = cfg.SportAssistLevels[i].TorqueAmplificationFactor;
+				SportAssistLevels[i].MaxPowerWatts = cfg.SportAssistLevels[i].MaxPowerWatts;
 			}
 		}
 
@@ -808,6 +980,15 @@ namespace BBSFW.Model
 			ValidateLimits(CurrentRampAmpsSecond, 1, 255, "Current Ramp (A/s)");
 			ValidateLimits((uint)MaxBatteryVolts, 1, 100, "Max Battery Voltage (V)");
 			ValidateLimits(LowCutoffVolts, 1, 100, "Low Voltage Cut Off (V)");
+			ValidateLimits((uint)BatteryCapacityAmpHours, 0, 100, "Battery Capacity (Ah)");
+			ValidateLimits((uint)LowVoltageFloorMarginVolts, 0, 25, "Low Voltage Floor Margin (V)");
+			if (BoostCurrentAmps != 0)
+			{
+				ValidateLimits(BoostCurrentAmps, MaxCurrentAmps, MaxCurrentLimitAmps, "Boost Current (A)");
+				ValidateLimits(BoostDurationSeconds, 1, 60, "Boost Duration (s)");
+			}
+			ValidateLimits(MotorInductanceMicroHenry, 0, 240, "Motor Inductance (uH)");
+			ValidateLimits((uint)MotorPwmFrequency, 0, 2, "Motor PWM Frequency");
 
 			ValidateLimits((uint)WheelSizeInch, 10, 40, "Wheel Size (inch)");
 			ValidateLimits(NumWheelSensorSignals, 1, 10, "Wheel Sensor Signals");
@@ -836,6 +1017,7 @@ namespace BBSFW.Model
 				ValidateLimits(StandardAssistLevels[i].MaxCadencePercent, 0, 100, $"Standard (Level {i}): Max Cadence (%)");
 				ValidateLimits(StandardAssistLevels[i].MaxSpeedPercent, 0, 100, $"Standard (Level {i}): Max Speed (%)");
 				ValidateLimits((uint)StandardAssistLevels[i].TorqueAmplificationFactor, 0, 25, $"Standard (Level {i}): Torque Amplification");
+				ValidateLimits(StandardAssistLevels[i].MaxPowerWatts, 0, 2550, $"Standard (Level {i}): Max Power (W)");
 			}
 
 			for (int i = 0; i < SportAssistLevels.Length; ++i)
@@ -845,6 +1027,7 @@ namespace BBSFW.Model
 				ValidateLimits(SportAssistLevels[i].MaxCadencePercent, 0, 100, $"Sport (Level {i}): Max Cadence (%)");
 				ValidateLimits(SportAssistLevels[i].MaxSpeedPercent, 0, 100, $"Sport (Level {i}): Max Speed (%)");
 				ValidateLimits((uint)SportAssistLevels[i].TorqueAmplificationFactor, 0, 25, $"Sport (Level {i}): Torque Amplification");
+				ValidateLimits(SportAssistLevels[i].MaxPowerWatts, 0, 2550, $"Sport (Level {i}): Max Power (W)");
 			}
 		}
 
@@ -18,6 +18,8 @@ namespace BBSFW.Model
 		private const int EVT_MSG_PSTATE_READ_DONE =			8;
 		private const int EVT_MSG_PSTATE_WRITE_BEGIN =			9;
 		private const int EVT_MSG_PSTATE_WRITE_DONE =			10;
+		private const int EVT_MSG_MOTOR_CALIBRATION_BEGIN =		11;
+		private const int EVT_MSG_MOTOR_CALIBRATION_DONE =		12;
 
 		private const int EVT_ERROR_INIT_MOTOR =				64;
 		private const int EVT_ERROR_CHANGE_TARGET_SPEED =		65;
@@ -36,6 +38,8 @@ namespace BBSFW.Model
 		private const int EVT_ERROR_WATCHDOG_TRIGGERED =		77;
 		private const int EVT_ERROR_EXTCOM_CHECKSUM =			78;
 		private const int EVT_ERROR_EXTCOM_DISCARD =			79;
+		private const int EVT_ERROR_MOTOR_CALIBRATION =			80;
+		private const int EVT_ERROR_MOTOR_PWM_FREQUENCY =		81;
 
 		private const int EVT_DATA_TARGET_CURRENT =				128;
 		private const int EVT_DATA_TARGET_SPEED =				129;
@@ -58,6 +62,16 @@ namespace BBSFW.Model
 		private const int EVT_DATA_VOLTAGE_CALIBRATION =		146;
 		private const int EVT_DATA_TORQUE_ADC =					147;
 		private const int EVT_DATA_TORQUE_ADC_CALIBRATED =		148;
+		private const int EVT_DATA_MOTOR_ROTOR_OFFSET =			149;
+		private const int EVT_DATA_MOTOR_INDUCTANCE =			150;
+		private const int EVT_DATA_BOOST_BUDGET =				151;
+		private const int EVT_DATA_POWER_LIMITING =				152;
+		private const int EVT_DATA_BATTERY_RESISTANCE =			153;
+		private const int EVT_DATA_LVC_FLOOR_LIMITING =			154;
+		private const int EVT_DATA_TASK_OVERRUN =				155;
+		private const int EVT_DATA_ASSIST_STAGES =				156;
+		private const int EVT_DATA_SVM_TABLE_HIT_RATE =			157;
+		private const int EVT_DATA_TASK_MAX_RUNTIME =			158;
 
 
 		public enum LogLevel
@@ -118,6 +132,10 @@ namespace BBSFW.Model
 					return "Writing persisted stated to eeprom.";
 				case EVT_MSG_PSTATE_WRITE_DONE:
 					return "Persisted state successfully written to eeprom.";
+				case EVT_MSG_MOTOR_CALIBRATION_BEGIN:
+					return "Motor calibration started, keep wheel in the air.";
+				case EVT_MSG_MOTOR_CALIBRATION_DONE:
+					return "Motor calibration successfully completed.";
 
 				case EVT_ERROR_INIT_MOTOR:
 					return "Failed to perform motor controller initialization.";
@@ -151,6 +169,21 @@ namespace BBSFW.Model
 					return "Message received with invalid checksum.";
 				case EVT_ERROR_EXTCOM_DISCARD:
 					return "Invalid message received on serial port, discarded.";
+				case EVT_ERROR_MOTOR_CALIBRATION:
+					switch (_data)
+					{
+						case 1:
+							return "Motor calibration aborted, brake activated.";
+						case 2:
+							return "Motor calibration aborted, low battery voltage.";
+						case 3:
+							return "Motor calibration failed, invalid hall sensor timing.";
+						case 4:
+							return "Motor calibration failed, motor not spinning freely.";
+					}
+					return $"Motor calibration failed, reason={_data}.";
+				case EVT_ERROR_MOTOR_PWM_FREQUENCY:
+					return $"Configured pwm frequency not supported, interrupt load {_data}%, using 15.6kHz.";
 
 				case EVT_DATA_TARGET_CURRENT:
 					return $"Motor target current changed to {_data}%.";
@@ -196,7 +229,16 @@ namespace BBSFW.Model
 				case EVT_DATA_MAX_CURRENT_ADC_RESPONSE:
 					return $"Max current configured on motor controller mcu, response was adc={_data}.";
 				case EVT_DATA_MAIN_LOOP_TIME:
-					return $"Main loop, interval={_data}ms.";
+					return $"Main loop, max interval={_data}ms.";
+				case EVT_DATA_TASK_OVERRUN:
+					Level = LogLevel.Warning;
+					return $"Scheduler task overrun, task={_data.Value >> 8}, count={_data.Value & 0xff}.";
+				case EVT_DATA_TASK_MAX_RUNTIME:
+					return $"Scheduler slowest task, task={_data.Value >> 8}, runtime={_data.Value & 0xff}ms.";
+				case EVT_DATA_ASSIST_STAGES:
+					return $"Assist pipeline stages, active=0x{_data.Value:X4}.";
+				case EVT_DATA_SVM_TABLE_HIT_RATE:
+					return $"Svm duty table hit rate, percent={_data}.";
 				case EVT_DATA_THROTTLE_ADC:
 					return $"Throttle adc, value={_data}.";
 				case EVT_DATA_LVC_LIMITING:
@@ -234,6 +276,32 @@ namespace BBSFW.Model
 					return $"Torque adc, value={_data}.";
 				case EVT_DATA_TORQUE_ADC_CALIBRATED:
 					return $"Torque sensor calibrated, adc_bias={_data}.";
+				case EVT_DATA_MOTOR_ROTOR_OFFSET:
+					return $"Motor rotor offset angle calibrated, value={_data}.";
+				case EVT_DATA_MOTOR_INDUCTANCE:
+					return $"Motor inductance identified, value={_data}uH.";
+				case EVT_DATA_BOOST_BUDGET:
+					return $"Boost budget remaining {_data}%.";
+				case EVT_DATA_LVC_FLOOR_LIMITING:
+					if (_data.Value != 0)
+					{
+						return $"Voltage floor limiting activated, current={(_data / 10f):0.0}A";
+					}
+					else
+					{
+						return "Voltage floor limiting deactivated.";
+					}
+				case EVT_DATA_BATTERY_RESISTANCE:
+					return $"Battery internal resistance estimated, value={_data}mOhm.";
+				case EVT_DATA_POWER_LIMITING:
+					if (_data.Value != 0)
+					{
+						return $"Power limiting activated, limit={_data}W.";
+					}
+					else
+					{
+						return "Power limiting deactivated.";
+					}
 			}
 
 			if (_data.HasValue)
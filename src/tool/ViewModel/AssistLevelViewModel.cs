@@ -281,6 +281,19 @@ namespace BBSFW.ViewModel
 			}
 		}
 
+		public uint MaxPowerWatts
+		{
+			get { return _level.MaxPowerWatts; }
+			set
+			{
+				if (_level.MaxPowerWatts != value)
+				{
+					_level.MaxPowerWatts = value;
+					OnPropertyChanged(nameof(MaxPowerWatts));
+				}
+			}
+		}
+
 
 		public AssistLevelViewModel(ConfigurationViewModel configVm, int id, Configuration.AssistLevel level)
 		{
@@ -48,6 +48,11 @@ namespace BBSFW.ViewModel
 			get { return new DelegateCommand(OnResetVoltageCalibration); }
 		}
 
+		public ICommand StartMotorCalibrationCommand
+		{
+			get { return new DelegateCommand(OnStartMotorCalibration); }
+		}
+
 
 		public CalibrationViewModel(ConnectionViewModel connectionVm)
 		{
@@ -113,5 +118,33 @@ namespace BBSFW.ViewModel
 			}
 		}
 
+		private async void OnStartMotorCalibration()
+		{
+			if (!_connectionVm.IsConnected)
+			{
+				MessageBox.Show("Not Connected!", "Error", MessageBoxButton.OK, MessageBoxImage.Error);
+				return;
+			}
+
+			if (MessageBox.Show("The motor will run at high speed for about 30 seconds, make sure the wheel is in the air. Continue?",
+				"Motor Calibration", MessageBoxButton.YesNo, MessageBoxImage.Warning) != MessageBoxResult.Yes)
+			{
+				return;
+			}
+
+			var res = await _connectionVm.GetConnection().StartMotorCalibration(TimeSpan.FromSeconds(3));
+			if (!res.Timeout)
+			{
+				if (!res.Result)
+				{
+					MessageBox.Show("Motor calibration could not be started, motor must be idle and controller must be a TSDZ2.", "Error", MessageBoxButton.OK, MessageBoxImage.Error);
+				}
+			}
+			else
+			{
+				MessageBox.Show("Failed to start motor calibration, timeout occured.", "Error", MessageBoxButton.OK, MessageBoxImage.Error);
+			}
+		}
+
 	}
 }
@@ -72,6 +72,14 @@ namespace BBSFW.ViewModel
 				new ValueItemViewModel<Configuration.LightsModeOptions>(Configuration.LightsModeOptions.BrakeLight, "Brake Light"),
 			};
 
+		public static List<ValueItemViewModel<Configuration.PwmFrequencyOptions>> MotorPwmFrequencyOptions { get; } =
+			new List<ValueItemViewModel<Configuration.PwmFrequencyOptions>>
+			{
+				new ValueItemViewModel<Configuration.PwmFrequencyOptions>(Configuration.PwmFrequencyOptions.Frequency15_6kHz, "15.6 kHz"),
+				new ValueItemViewModel<Configuration.PwmFrequencyOptions>(Configuration.PwmFrequencyOptions.Frequency19_5kHz, "19.5 kHz"),
+				new ValueItemViewModel<Configuration.PwmFrequencyOptions>(Configuration.PwmFrequencyOptions.Frequency23_4kHz, "23.4 kHz"),
+			};
+
 
 		// support 
 
@@ -85,6 +93,11 @@ namespace BBSFW.ViewModel
 			get { return _config.IsFeatureSupported(Configuration.Feature.ShiftSensor); }
 		}
 
+		public bool IsMotorControlSupported
+		{
+			get { return _config.IsFeatureSupported(Configuration.Feature.MotorControl); }
+		}
+
 
 		// configuration
 
@@ -143,6 +156,32 @@ namespace BBSFW.ViewModel
 			}
 		}
 
+		public uint BoostCurrentAmps
+		{
+			get { return _config.BoostCurrentAmps; }
+			set
+			{
+				if (_config.BoostCurrentAmps != value)
+				{
+					_config.BoostCurrentAmps = value;
+					OnPropertyChanged(nameof(BoostCurrentAmps));
+				}
+			}
+		}
+
+		public uint BoostDurationSeconds
+		{
+			get { return _config.BoostDurationSeconds; }
+			set
+			{
+				if (_config.BoostDurationSeconds != value)
+				{
+					_config.BoostDurationSeconds = value;
+					OnPropertyChanged(nameof(BoostDurationSeconds));
+				}
+			}
+		}
+
 		public uint CurrentRampAmpsSecond
 		{
 			get { return _config.CurrentRampAmpsSecond; }
@@ -169,6 +208,32 @@ namespace BBSFW.ViewModel
 			}
 		}
 
+		public float BatteryCapacityAmpHours
+		{
+			get { return _config.BatteryCapacityAmpHours; }
+			set
+			{
+				if (_config.BatteryCapacityAmpHours != value)
+				{
+					_config.BatteryCapacityAmpHours = value;
+					OnPropertyChanged(nameof(BatteryCapacityAmpHours));
+				}
+			}
+		}
+
+		public float LowVoltageFloorMarginVolts
+		{
+			get { return _config.LowVoltageFloorMarginVolts; }
+			set
+			{
+				if (_config.LowVoltageFloorMarginVolts != value)
+				{
+					_config.LowVoltageFloorMarginVolts = value;
+					OnPropertyChanged(nameof(LowVoltageFloorMarginVolts));
+				}
+			}
+		}
+
 		public uint LowCutoffVolts
 		{
 			get { return _config.LowCutoffVolts; }
@@ -210,6 +275,35 @@ namespace BBSFW.ViewModel
 			}
 		}
 
+		public uint MotorInductanceMicroHenry
+		{
+			get { return _config.MotorInductanceMicroHenry; }
+			set
+			{
+				if (_config.MotorInductanceMicroHenry != value)
+				{
+					_config.MotorInductanceMicroHenry = value;
+					OnPropertyChanged(nameof(MotorInductanceMicroHenry));
+				}
+			}
+		}
+
+		public ValueItemViewModel<Configuration.PwmFrequencyOptions> MotorPwmFrequency
+		{
+			get
+			{
+				return MotorPwmFrequencyOptions.FirstOrDefault((e) => e.Value == _config.MotorPwmFrequency);
+			}
+			set
+			{
+				if (_config.MotorPwmFrequency != value.Value)
+				{
+					_config.MotorPwmFrequency = value.Value;
+					OnPropertyChanged(nameof(MotorPwmFrequency));
+				}
+			}
+		}
+
 		public bool UseSpeedSensor
 		{
 			get { return _config.UseSpeedSensor; }